@@ -1,29 +1,60 @@
 #include "buttons.h"
 #include <bios.h>
+#include <dos.h>
 #include <dpmi.h>
 #include <go32.h>
+#include <pc.h>
+#include <sys/farptr.h>
+#include <time.h>
 
 // https://stackoverflow.com/questions/40961527/checking-if-a-key-is-down-in-ms-dos-c-c
 // https://www.delorie.com/djgpp/doc/ug/interrupts/inthandlers2.html
 // https://soulsphere.org/random/old-dos-code/docs/iea292.txt
 // http://www.ctyme.com/intr/rb-0045.htm
 
+KeyEvents keyEvents;
+
 static bool keyPressed[0x60] = {};
 
+static inline __attribute__((always_inline)) uint64_t readTimer() {
+    // BIOS ticks and the count of PIT channel 0 within the tick, which uclock set to count its units down
+    outportb(0x43, 0x00);
+    const uint8_t low = inportb(0x40), high = inportb(0x40);
+    const uint16_t elapsed = -(low | high << 8);
+    uint32_t ticks = _farpeekl(_dos_ds, 0x46C);
+
+    // The PIT may have wrapped with the tick interrupt still pending in the PIC
+    outportb(0x20, 0x0A);
+    if (inportb(0x20) & 0x1 && elapsed < 0x8000) ticks++;
+    return (uint64_t)ticks << 16 | elapsed;
+}
+
 static __attribute__((no_reorder)) void keybHandler() {
+    // uclock isn't reentrant nor locked, the raw timer is converted to its time outside the IRQ
     const uint8_t keyCode = inportb(0x60);
-    if (keyCode < 0xE0)
+    if (keyCode < 0xE0) {
         keyPressed[keyCode & 0x7F] = (keyCode & 0x80) == 0;
+        if ((uint8_t)(keyEvents.head + 1) != keyEvents.tail) {
+            if (keyEvents.stamp) keyEvents.times[keyEvents.head] = readTimer();
+            keyEvents.events[keyEvents.head++] = keyCode;
+        }
+    }
 
     outportb(0x20, 0x20);
 }
 
 static __attribute__((no_reorder)) _go32_dpmi_seginfo origHandler, myHandler;
 
-Keyboard initKeyboard() {
+Keyboard initKeyboard(const bool stampEvents) {
+    // The first call sets the timer up, which mustn't happen in the IRQ
+    keyEvents.stamp = stampEvents;
+    uclock();
+
     _go32_dpmi_get_protected_mode_interrupt_vector(0x9, &origHandler);
     _go32_dpmi_lock_code(keybHandler, (size_t)initKeyboard - (size_t)keybHandler);
     _go32_dpmi_lock_data(keyPressed, sizeof(keyPressed));
+    _go32_dpmi_lock_data(&keyEvents, sizeof(keyEvents));
+    _go32_dpmi_lock_data(&_go32_info_block, sizeof(_go32_info_block));
 
     myHandler.pm_offset = (size_t)keybHandler;
     myHandler.pm_selector = _go32_my_cs();
@@ -39,20 +70,7 @@ void deleteKeyboard(Keyboard *keyb) {
     _go32_dpmi_free_iret_wrapper(&myHandler);
 }
 
-static uint8_t buttonPressedMasks[2] = {0x3F, 0x3F};
-
-bool processEvents(bool channels[4], bool *bgViewer, bool *loudness) {
-    buttonPressedMasks[0] = 0x30 |
-        (keyPressed[0x2D] ? 0 : 0x1) | // A (X)
-        (keyPressed[0x2E] ? 0 : 0x2) | // B (C)
-        (keyPressed[0x39] ? 0 : 0x4) | // Select (Space)
-        (keyPressed[0x36] ? 0 : 0x8);  // Start (Right Shift)
-    buttonPressedMasks[1] = 0x30 |
-        (keyPressed[0x4D] ? 0 : 0x1) | // Right
-        (keyPressed[0x4B] ? 0 : 0x2) | // Left
-        (keyPressed[0x48] ? 0 : 0x4) | // Up
-        (keyPressed[0x50] ? 0 : 0x8);  // Down
-
+bool processEvents(bool channels[4], bool *bgViewer, bool *loudness, bool *turbo) {
     for (uint8_t i = 0; i < 4; i++) {
         if (keyPressed[0x3B + i]) channels[i] = true;
         if (keyPressed[0x3F + i]) channels[i] = false;
@@ -68,13 +86,19 @@ bool processEvents(bool channels[4], bool *bgViewer, bool *loudness) {
         *bgViewer = !*bgViewer;
     }
 
+    if (keyPressed[0x0F]) {
+        keyPressed[0x0F] = false;
+        *turbo = !*turbo;
+    }
+
     return keyPressed[0x01];
 }
 
-uint8_t updateInputReg(const uint8_t value) {
-    switch (value & 0x30) {
-        case 0x10: return buttonPressedMasks[0];
-        case 0x20: return buttonPressedMasks[1];
-        default: return 0x3F;
-    }
+uclock_t keyTime(const uint64_t stamp) {
+    // The PIT counts uclock units, so both clocks are apart by the same time now as when the key was stamped
+    disable();
+    const uint64_t now = readTimer();
+    const uclock_t time = uclock();
+    enable();
+    return time - (uclock_t)(now - stamp);
 }
@@ -1,12 +1,15 @@
 #pragma once
 
-#include "global.h"
+#include "joypad.h"
+#include <time.h>
 
 typedef struct {
 } Keyboard;
 
-Keyboard __attribute__((no_reorder)) initKeyboard();
+extern KeyEvents keyEvents;
+
+Keyboard __attribute__((no_reorder)) initKeyboard(const bool stampEvents);
 void deleteKeyboard(Keyboard *keyb);
 
-bool processEvents(bool channels[4], bool *bgViewer, bool *loudness);
-uint8_t updateInputReg(const uint8_t value);
+bool processEvents(bool channels[4], bool *bgViewer, bool *loudness, bool *turbo);
+uclock_t keyTime(const uint64_t stamp);
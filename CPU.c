@@ -1,6 +1,8 @@
 #include "cpu.h"
-#include "buttons.h"
+#include "jit.h"
+#include "joypad.h"
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 //#define TURBO_INTERRUPTS
@@ -19,11 +21,16 @@
 static uint32_t pairs[512 * 512] = {};
 #endif
 
+#ifdef RECOMPILED
+typedef bool (*Block)(CPU *cpu, const uint64_t breakAt);
+static bool recompiledROM(const Memory *mem);
+#endif
+
 static const uint8_t bootROM[0x100] = {
     #include "boot.rom"
 };
 
-static inline uint8_t read8(const Memory *mem, const uint16_t address) {
+static inline uint8_t read8(const Memory *mem, const uint16_t address, const bool booting) {
 /*
     switch (address) {
 //        case 0xFF01 ... 0xFF03: printf("%X -> %02X\n", address, mem->IO[address & 0x7F]); break;
@@ -36,18 +43,24 @@ static inline uint8_t read8(const Memory *mem, const uint16_t address) {
 //        case 0xFF00 ... 0xFFFF: printf("%X -> ??\n"  , address                         ); break;
     }
 //*/
+    // Only HRAM and IO are reachable by the CPU during OAM DMA
+    if (UNLIKELY(mem->dmaEnd) && address < 0xFF00)
+        return 0xFF;
+
     switch (address) {
-        case 0x0000 ... 0x00FF: if (UNLIKELY(!mem->IO[0x50])) return bootROM        [address & 0xFF  ]; FALLTHROUGH;
-        case 0x0100 ... 0x3FFF: return mem->romBanks[mem->rom0Bank]                 [address         ];
-        case 0x4000 ... 0x7FFF: return mem->romBanks[mem->romBank ]                 [address & 0x3FFF];
-        case 0x8000 ... 0x9FFF: return (mem->IO[0x41] & 0x3) == 3 ? 0xFF : mem->VRAM[address & 0x1FFF];
-        case 0xA000 ... 0xBFFF: return mem->ram ? mem->externalRAM[mem->ramBank]    [address & 0x1FFF] : 0xFF;
-        case 0xC000 ... 0xDFFF: return mem->internalRAM                             [address & 0x1FFF];
+        case 0x0000 ... 0x00FF: if (booting && UNLIKELY(!mem->IO[0x50])) return bootROM[address & 0xFF]; FALLTHROUGH;
+        case 0x0100 ... 0x3FFF: return mem->rom0                                    [address         ];
+        case 0x4000 ... 0x7FFF: return mem->romx                                    [address & 0x3FFF];
+        case 0x8000 ... 0x9FFF: return (mem->IO[0x41] & 0x3) == 3 ? 0xFF : mem->vramBank[address & 0x1FFF];
+        case 0xA000 ... 0xBFFF: return LIKELY(mem->sram) ? mem->sram[address & 0x1FFF] : mem->mbc->readRAM(mem, address);
+        case 0xC000 ... 0xCFFF: return mem->internalRAM[0]                          [address & 0xFFF ];
+        case 0xD000 ... 0xDFFF: return mem->wramBank                                [address & 0xFFF ];
         case 0xE000 ... 0xFDFF: return mem->patchMem                                [address & 0x1FFF];
         case 0xFE00 ... 0xFE9F: return (mem->IO[0x41] & 0x3) > 1 ? 0xFF : ((uint8_t*)mem->OAM)[address & 0xFF];
         case 0xFEA0 ... 0xFEFF: return 0;
-        case 0xFF00 ... 0xFF4B: return mem->IO                                      [address & 0x7F  ];
-        case 0xFF4C ... 0xFF7F: return 0xFF;
+        case 0xFF00 ... 0xFF4F: return mem->IO                                      [address & 0x7F  ];
+        case 0xFF50           : return 0xFF;
+        case 0xFF51 ... 0xFF7F: return mem->IO                                      [address & 0x7F  ];
         case 0xFF80 ... 0xFFFE: return mem->HRAM                                    [address & 0x7F  ];
         case 0xFFFF           : return mem->interruptReg;
         default: UNREACHABLE; return 0xFF;
@@ -57,11 +70,12 @@ static inline uint8_t read8(const Memory *mem, const uint16_t address) {
 static inline const uint8_t* readp(const Memory *mem, const uint16_t address) {
     switch (address) {
         case 0x0000 ... 0x00FF: if (!mem->IO[0x50]) return &bootROM   [address         ]; FALLTHROUGH;
-        case 0x0100 ... 0x3FFF: return &mem->romBanks[mem->rom0Bank]  [address         ];
-        case 0x4000 ... 0x7FFF: return &mem->romBanks[mem->romBank ]  [address & 0x3FFF];
-        case 0x8000 ... 0x9FFF: return &mem->VRAM                     [address & 0x1FFF];
-        case 0xA000 ... 0xBFFF: return &mem->externalRAM[mem->ramBank][address & 0x1FFF];
-        case 0xC000 ... 0xDFFF: return &mem->internalRAM              [address & 0x1FFF];
+        case 0x0100 ... 0x3FFF: return &mem->rom0                     [address         ];
+        case 0x4000 ... 0x7FFF: return &mem->romx                     [address & 0x3FFF];
+        case 0x8000 ... 0x9FFF: return &mem->vramBank                 [address & 0x1FFF];
+        case 0xA000 ... 0xBFFF: return &mem->ramBank                  [address & 0x1FFF];
+        case 0xC000 ... 0xCFFF: return &mem->internalRAM[0]           [address & 0xFFF ];
+        case 0xD000 ... 0xDFFF: return &mem->wramBank                 [address & 0xFFF ];
         case 0xE000 ... 0xFDFF: return &mem->patchMem                 [address & 0x1FFF];
         case 0xFF80 ... 0xFFFE: return &mem->HRAM                     [address & 0x7F  ];
         default: UNREACHABLE; return NULL;
@@ -74,18 +88,114 @@ static inline uint16_t pop16(const Memory *mem, uint16_t *sp) {
     return value;
 }
 
-static inline void updateBanks(Memory *mem) {
-    mem->rom0Bank = mem->mbcGen == 5 ? 0 : (mem->currRAMBank & 0x3) << 5 & (mem->nbROMBanks - 1);
-    mem->ramBank = mem->mbcGen != 1 || mem->mbcMode ? mem->currRAMBank & (mem->nbRAMBanks - 1) : 0;
-    const uint16_t bank = mem->mbcGen == 5 ? mem->currROMBank : (mem->currRAMBank & 0x3) << 5 | mem->currROMBank;
-    mem->romBank = bank & (mem->nbROMBanks - 1);
-}
-
 static inline uint8_t maskedWrite(uint8_t oldval, uint8_t newval, const uint8_t mask) {
     return oldval ^ ((oldval ^ newval) & mask);
 }
 
-static inline void write8(Memory *mem, const uint16_t address, const uint8_t value) {
+static inline void catchUpScreen(Memory *mem) {
+    if (UNLIKELY(mem->lateLines.screen)) mem->lateLines.draw(mem->lateLines.screen);
+}
+
+static inline void markVRAM(Memory *mem, const uint16_t address, const uint32_t cells) {
+    DirtyVRAM *dirty = &mem->dirtyVRAM;
+    const uint16_t offset = address & 0x1FFF;
+    if (offset < 0x1800) {
+        const uint16_t tile = (mem->vramBank != mem->VRAM[0]) * 384 + (offset >> 4);
+        dirty->tiles[tile >> 5] |= 1u << (tile & 0x1F);
+    } else {
+        dirty->cells[offset >> 10 & 0x1][offset >> 5 & 0x1F] |= cells << (offset & 0x1F);
+    }
+    dirty->modified = true;
+}
+
+static inline void journalWrite(Memory *mem, const uint8_t reg, const uint8_t value, const uint64_t cycles) {
+    LineJournal *journal = &mem->journal;
+    catchUpScreen(mem);
+    if (UNLIKELY(journal->start)) {
+        if (journal->count < ARRAY_SIZE(journal->writes)) {
+            const uint8_t x = cycles <= journal->start ? 0 : MIN(160, (cycles - journal->start) << 2);
+            journal->writes[journal->count++] = (RegWrite){.x = x, .reg = reg, .value = mem->IO[reg]};
+        } else {
+            journal->overflowed = true;
+        }
+    }
+
+    mem->IO[reg] = value;
+}
+
+static inline void copyHDMA(Memory *mem, uint16_t length) {
+    // Copies are batched up to the end of the source region or of VRAM, E000-FFFF sources read A000-BFFF
+    catchUpScreen(mem);
+    while (length > 0) {
+        const uint16_t source = (mem->hdmaSource & 0xE000) == 0xE000 ? mem->hdmaSource - 0x4000 : mem->hdmaSource;
+        const uint16_t count = MIN(length, MIN(WRAM_SIZE - (source & 0xFFF), RAM_SIZE - mem->hdmaDest));
+        memcpy(&mem->vramBank[mem->hdmaDest], readp(mem, source), count);
+        for (uint16_t i = 0; i < count; i += 16) markVRAM(mem, mem->hdmaDest + i, 0xFFFF);
+        mem->hdmaSource += count;
+        mem->hdmaDest = (mem->hdmaDest + count) & 0x1FFF;
+        length -= count;
+    }
+}
+
+static inline void startHDMA(Memory *mem, const uint8_t value) {
+    if (mem->hdmaBlocks && !(value & 0x80)) {
+        mem->hdmaBlocks = 0;
+        mem->IO[0x55] |= 0x80;
+    } else if (value & 0x80) {
+        mem->hdmaBlocks = (value & 0x7F) + 1;
+        mem->hdmaLine = 0xFF;
+        mem->IO[0x55] = value & 0x7F;
+    } else {
+        copyHDMA(mem, ((value & 0x7F) + 1) << 4);
+        mem->IO[0x55] = 0xFF;
+    }
+}
+
+static inline void hblankDMA(Memory *mem) {
+    // One block per H-Blank, the screen publishes its mode before each CPU slice
+    if ((mem->IO[0x41] & 0x3) == 0 && mem->IO[0x44] < 144 && mem->hdmaLine != mem->IO[0x44]) {
+        mem->hdmaLine = mem->IO[0x44];
+        copyHDMA(mem, 16);
+        mem->IO[0x55] = --mem->hdmaBlocks ? mem->hdmaBlocks - 1 : 0xFF;
+    }
+}
+
+static inline void updateInterrupts(Memory *mem) {
+    mem->interruptPending = mem->interruptReg & mem->IO[0x0F] & 0x1F;
+}
+
+static inline void serialTransfer(Memory *mem) {
+    // The bytes are exchanged at the end of the transfer, the peer only receives if it waits on the external clock
+    Memory *peer = mem->peer;
+    if ((peer->IO[0x02] & 0x81) == 0x80) {
+        SWAP(mem->IO[0x01], peer->IO[0x01]);
+        peer->IO[0x02] &= 0x7F;
+        peer->IO[0x0F] |= 0x8;
+        updateInterrupts(peer);
+    } else {
+        mem->IO[0x01] = 0xFF;
+    }
+
+    mem->IO[0x02] &= 0x7F;
+    mem->IO[0x0F] |= 0x8;
+    mem->serialEnd = 0;
+    updateInterrupts(mem);
+}
+
+static inline void writePalette(Memory *mem, const uint8_t reg, const uint8_t value) {
+    // BCPS/OCPS select a byte of the BG/OBJ palette RAM, auto-incremented on BCPD/OCPD writes if bit 7 is set
+    uint8_t *palettes = mem->palettes[reg >= 0x6A], *spec = &mem->IO[reg & 0xFE];
+    if (reg & 0x1) {
+        palettes[*spec & 0x3F] = value;
+        mem->palettesModified = true;
+        if (*spec & 0x80) *spec = (*spec & 0xC0) | ((*spec + 1) & 0x3F);
+    } else {
+        *spec = value | 0x40;
+    }
+    mem->IO[reg | 0x1] = palettes[*spec & 0x3F];
+}
+
+static inline void write8(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
 /*
     switch (address) {
 //        case 0x0000 ... 0x1FFF: printf("%X <- %02X\n", address, value); break;
@@ -109,25 +219,27 @@ static inline void write8(Memory *mem, const uint16_t address, const uint8_t val
 //        case 0xFFFF           : printf("%X <- %02X\n", address, value); break;
     }
 //*/
+    if (UNLIKELY(mem->dmaEnd) && address < 0xFF00)
+        return;
+
     switch (address) {
-        case 0x0000 ... 0x1FFF: mem->ram = (value & 0xF) == 0xA; break;
-        case 0x3000 ... 0x3FFF: if (mem->mbcGen == 5) {mem->currROMBank = (mem->currROMBank & 0xFF) | (value & 1) << 8; updateBanks(mem); break;} FALLTHROUGH;
-        case 0x2000 ... 0x2FFF: mem->currROMBank = (mem->mbcGen == 5) ? (mem->currROMBank & 0xFF00) | value : (value & 0x1F) ? : 1; updateBanks(mem); break;
-        case 0x4000 ... 0x5FFF: mem->currRAMBank = value; updateBanks(mem); break;
-        case 0x6000 ... 0x7FFF: mem->mbcMode = value & 1; updateBanks(mem); break;
-        case 0x8000 ... 0x9FFF: if ((mem->IO[0x41] & 0x3) != 3) mem->VRAM[address & 0x1FFF] = value; break;
-        case 0xA000 ... 0xBFFF: if (mem->ram) mem->externalRAM[mem->ramBank][address & 0x1FFF] = value; break;
-        case 0xC000 ... 0xDFFF: mem->internalRAM[address & 0x1FFF] = value; break;
+        case 0x0000 ... 0x7FFF: mem->mbc->write(mem, address, value, cycles); break;
+        case 0x8000 ... 0x9FFF: if ((mem->IO[0x41] & 0x3) != 3) {catchUpScreen(mem); mem->vramBank[address & 0x1FFF] = value; markVRAM(mem, address, 1);} break;
+        case 0xA000 ... 0xBFFF: if (LIKELY(mem->sram)) mem->sram[address & 0x1FFF] = value; else mem->mbc->writeRAM(mem, address, value, cycles); break;
+        case 0xC000 ... 0xCFFF: mem->internalRAM[0][address & 0xFFF] = value; break;
+        case 0xD000 ... 0xDFFF: mem->wramBank[address & 0xFFF] = value; break;
         case 0xE000 ... 0xFDFF: mem->patchMem[address & 0x1FFF] = value; break;
-        case 0xFE00 ... 0xFE9F: if ((mem->IO[0x41] & 0x3) < 2) ((uint8_t*)mem->OAM)[address & 0xFF] = value; break;
+        case 0xFE00 ... 0xFE9F: if ((mem->IO[0x41] & 0x3) < 2) {catchUpScreen(mem); ((uint8_t*)mem->OAM)[address & 0xFF] = value; mem->oamModified = true;} break;
         case 0xFEA0 ... 0xFEFF: break;
-        case 0xFF00           : mem->IO[address & 0x7F]    = updateInputReg(value); break;
+        case 0xFF00           : if (drainInputs(mem)) {mem->IO[0x0F] |= 0x10; updateInterrupts(mem);} mem->IO[address & 0x7F] = updateInputReg(mem, value); break;
         case 0xFF01           : mem->IO[0x01] = value; break;
-        case 0xFF02           : mem->IO[0x02] = value; if (value == 0x81) {mem->IO[0x0F] |= 0x8; mem->IO[0x01] = 0xFF; mem->IO[0x02] = 0x01;} break;
+        case 0xFF02           : mem->IO[0x02] = value; if (value == 0x81) {if (mem->peer) mem->serialEnd = cycles + SERIAL_CLKS; else {mem->IO[0x0F] |= 0x8; mem->IO[0x01] = 0xFF; mem->IO[0x02] = 0x01; updateInterrupts(mem);}} break;
         case 0xFF03 ... 0xFF04: *(uint16_t*)&mem->IO[0x03] = 0;     break;
         case 0xFF05 ... 0xFF06: mem->IO[address & 0x7F]    = value; break;
         case 0xFF07           : mem->IO[address & 0x7F]    = maskedWrite(mem->IO[address & 0x7F], value, 0x7); break;
-        case 0xFF08 ... 0xFF11: mem->IO[address & 0x7F]    = value; break;
+        case 0xFF08 ... 0xFF0E: mem->IO[address & 0x7F]    = value; break;
+        case 0xFF0F           : mem->IO[address & 0x7F]    = value; updateInterrupts(mem); break;
+        case 0xFF10 ... 0xFF11: mem->IO[address & 0x7F]    = value; break;
 //        case 0xFF12           : if ((mem->IO[address & 0x7F] & 0xF) == 0x8 && (value & 0xF) == 0x8 && (mem->IO[0x26] & 0x1) != 0) mem->IO[address & 0x7F] += 0x10; else mem->IO[address & 0x7F] = value; break;
         case 0xFF12           : mem->IO[address & 0x7F]    = value; break;
         case 0xFF13 ... 0xFF16: mem->IO[address & 0x7F]    = value; break;
@@ -135,64 +247,91 @@ static inline void write8(Memory *mem, const uint16_t address, const uint8_t val
         case 0xFF17           : mem->IO[address & 0x7F]    = value; break;
         case 0xFF18 ... 0xFF25: mem->IO[address & 0x7F]    = value; break;
         case 0xFF26           : mem->IO[address & 0x7F]    = maskedWrite(mem->IO[address & 0x7F], value, 0x80); break;
-        case 0xFF27 ... 0xFF40: mem->IO[address & 0x7F]    = value; break;
+        case 0xFF27 ... 0xFF3F: mem->IO[address & 0x7F]    = value; break;
+        case 0xFF40           : journalWrite(mem, address & 0x7F, value, cycles); break;
         case 0xFF41           : mem->IO[address & 0x7F]    = maskedWrite(mem->IO[address & 0x7F], value, 0x78); break;
-        case 0xFF42 ... 0xFF43: mem->IO[address & 0x7F]    = value; break;
+        case 0xFF42 ... 0xFF43: journalWrite(mem, address & 0x7F, value, cycles); break;
         case 0xFF44           : break;
         case 0xFF45           : mem->IO[address & 0x7F]    = value; break;
-        case 0xFF46           : memcpy(mem->OAM, readp(mem, value << 8), sizeof(mem->OAM)); break;
-        case 0xFF47 ... 0xFF50: mem->IO[address & 0x7F]    = value; break;
-        case 0xFF51 ... 0xFF7F: break;
+        case 0xFF46           : mem->dmaSource = value; mem->dmaEnd = cycles + DMA_CLKS + 4; break;
+        case 0xFF47 ... 0xFF49: mem->IO[address & 0x7F]    = value; break;
+        case 0xFF4A           : catchUpScreen(mem); mem->IO[address & 0x7F] = value; break;
+        case 0xFF4B           : journalWrite(mem, address & 0x7F, value, cycles); break;
+        case 0xFF4C           : break;
+        case 0xFF4D           : if (mem->cgb) mem->IO[address & 0x7F] = maskedWrite(mem->IO[address & 0x7F], value, 0x1); break;
+        case 0xFF4E           : break;
+        case 0xFF4F           : if (mem->cgb) {mem->IO[address & 0x7F] = 0xFE | value; mem->vramBank = mem->VRAM[value & 0x1];} break;
+        case 0xFF50           : mem->IO[address & 0x7F]    = value; break;
+        case 0xFF51           : mem->hdmaSource = (mem->hdmaSource & 0x00F0) | value << 8; break;
+        case 0xFF52           : mem->hdmaSource = (mem->hdmaSource & 0xFF00) | (value & 0xF0); break;
+        case 0xFF53           : mem->hdmaDest   = (mem->hdmaDest   & 0x00F0) | (value & 0x1F) << 8; break;
+        case 0xFF54           : mem->hdmaDest   = (mem->hdmaDest   & 0x1F00) | (value & 0xF0); break;
+        case 0xFF55           : if (mem->cgb) startHDMA(mem, value); break;
+        case 0xFF56 ... 0xFF67: break;
+        case 0xFF68 ... 0xFF6B: if (mem->cgb) writePalette(mem, address & 0x7F, value); break;
+        case 0xFF6C ... 0xFF6F: break;
+        case 0xFF70           : if (mem->cgb) {mem->IO[address & 0x7F] = 0xF8 | value; mem->wramBank = mem->internalRAM[(value & 0x7) ? : 1];} break;
+        case 0xFF71 ... 0xFF7F: break;
         case 0xFF80 ... 0xFFFE: mem->HRAM[address & 0x7F]  = value; break;
-        case 0xFFFF           : mem->interruptReg          = value; break;
+        case 0xFFFF           : mem->interruptReg          = value; updateInterrupts(mem); break;
         default: UNREACHABLE;
     }
 }
 
 static inline void writep(Memory *mem, const uint16_t address, const uint16_t value) {
     switch (address) {
-        case 0x8000 ... 0x9FFF: *(uint16_t*)&mem->VRAM                     [address & 0x1FFF] = value; return;
-        case 0xA000 ... 0xBFFF: *(uint16_t*)&mem->externalRAM[mem->ramBank][address & 0x1FFF] = value; return;
-        case 0xC000 ... 0xDFFF: *(uint16_t*)&mem->internalRAM              [address & 0x1FFF] = value; return;
+        case 0x8000 ... 0x9FFF: catchUpScreen(mem); *(uint16_t*)&mem->vramBank     [address & 0x1FFF] = value; markVRAM(mem, address, 1); markVRAM(mem, address + 1, 1); return;
+        case 0xA000 ... 0xBFFF: *(uint16_t*)&mem->ramBank                  [address & 0x1FFF] = value; return;
+        case 0xC000 ... 0xCFFF: *(uint16_t*)&mem->internalRAM[0]           [address & 0xFFF ] = value; return;
+        case 0xD000 ... 0xDFFF: *(uint16_t*)&mem->wramBank                 [address & 0xFFF ] = value; return;
         case 0xE000 ... 0xFDFF: *(uint16_t*)&mem->patchMem                 [address & 0x1FFF] = value; return;
         case 0xFF80 ... 0xFFFE: *(uint16_t*)&mem->HRAM                     [address & 0x7F  ] = value; return;
         default: UNREACHABLE;
     }
 }
 
-#ifdef DEBUG
 typedef struct {
     uint8_t length, duration;
     char mnemonic[13];
+    const char *flags, *code;
 } Instruction;
 
-static Instruction instructions[512] = {
-    #define INSTRUCTION(_opcode, _mnemonic, _length, _duration, _flags, _code) {_length, _duration, _mnemonic},
+static const Instruction instructions[512] = {
+    #define INSTRUCTION(_opcode, _mnemonic, _length, _duration, _flags, _code) {_length, _duration, _mnemonic, _flags, #_code},
     #include "lr35902.inl"
     #undef INSTRUCTION
 };
-#endif
 
-CPU initCPU(const char *cartridge, const bool bootSequence, const uint8_t hackLevel) {
-    CPU cpu = {.mem = initMemory(cartridge, hackLevel)};
-    updateBanks(cpu.mem);
+CPU initCPU(const char *cartridge, const bool bootSequence, const uint8_t hackLevel, const bool cgb) {
+    CPU cpu = {.mem = initMemory(cartridge, hackLevel, cgb)};
 
-    if (!bootSequence) {
-        cpu.AF = 0x01B0;
-        cpu.BC = 0x0013;
-        cpu.DE = 0x00D8;
-        cpu.HL = 0x014D;
+    // Only the DMG boot ROM is available, CGB games start with the registers left by the CGB one
+    if (!bootSequence || cpu.mem->cgb) {
+        cpu.AF = cpu.mem->cgb ? 0x1180 : 0x01B0;
+        cpu.BC = cpu.mem->cgb ? 0x0000 : 0x0013;
+        cpu.DE = cpu.mem->cgb ? 0xFF56 : 0x00D8;
+        cpu.HL = cpu.mem->cgb ? 0x000D : 0x014D;
         cpu.SP = 0xFFFE;
         cpu.PC = 0x0100;
         cpu.mem->IO[0x40] = 0x91;
         cpu.mem->IO[0x50] = 0x01;
     }
 
+#ifdef RECOMPILED
+    cpu.recompiled = recompiledROM(cpu.mem);
+#endif
+#ifdef JIT
+    cpu.jit = initJit(cpu.mem);
+#endif
     return cpu;
 }
 
 void deleteCPU(CPU *cpu) {
+    updateRTC(&cpu->mem->rtc, cpu->cycles);
     deleteMemory(cpu->mem);
+#ifdef JIT
+    deleteJit(cpu->jit);
+#endif
 
 #ifdef PROFILE_PAIRS
     for (uint32_t i = 0; i < ARRAY_SIZE(pairs); i++)
@@ -214,6 +353,257 @@ static void logInstruction(CPU *cpu, FILE *logFile, const uint8_t pc, const uint
 }
 #endif
 
+static inline void traceInstruction(CPU *cpu, const uint16_t pc, const uint16_t opcode, const uint16_t operand, const uint8_t cycles) {
+    Trace *trace = cpu->trace;
+    const bool romx = pc >= 0x4000 && pc < 0x8000;
+    const uint16_t bank = romx ? (cpu->mem->romx - cpu->mem->romBanks[0]) / ROM_BANK_SIZE : 0;
+    trace->entries[trace->next] = (TraceEntry){.pc = pc, .operand = operand, .bank = bank, .opcode = opcode, .cycles = MIN(cycles, 0x7F)};
+    trace->wrapped |= ++trace->next == 0;
+    if (romx)
+        trace->romxCycles[bank][pc - 0x4000] += cycles;
+    else
+        trace->pcCycles[pc] += cycles;
+    trace->bankCycles[bank & 0x1FF] += cycles;
+}
+
+static void formatInstruction(char str[16], const uint16_t opcode, const uint16_t operand) {
+    const Instruction *instr = &instructions[opcode];
+    sprintf(str, instr->mnemonic, instr->length == 2 ? (uint16_t)(int8_t)operand : operand);
+}
+
+Trace* initTrace(const Memory *mem) {
+    Trace *trace = calloc(1, sizeof(Trace));
+    trace->romxCycles = calloc(mem->nbROMBanks, sizeof(*trace->romxCycles));
+    return trace;
+}
+
+void deleteTrace(Trace *trace) {
+    free(trace->romxCycles);
+    free(trace);
+}
+
+void writeTrace(const CPU *cpu, FILE *file) {
+    // Oldest entry first
+    const Trace *trace = cpu->trace;
+    if (trace->wrapped)
+        fwrite(&trace->entries[trace->next], sizeof(TraceEntry), TRACE_SIZE - trace->next, file);
+    fwrite(trace->entries, sizeof(TraceEntry), trace->next, file);
+}
+
+void reportHotSpots(const CPU *cpu, FILE *file) {
+    const Trace *trace = cpu->trace;
+    uint64_t total = 0;
+    for (uint16_t i = 0; i < ARRAY_SIZE(trace->bankCycles); i++)
+        total += trace->bankCycles[i];
+    if (total == 0)
+        return;
+
+    // Repeated selection of the maximum, the reports are short
+    fputs("Bank  Cycles\n", file);
+    bool reported[512] = {};
+    for (uint8_t n = 0; n < 8; n++) {
+        int16_t best = -1;
+        for (uint16_t i = 0; i < ARRAY_SIZE(trace->bankCycles); i++)
+            if (!reported[i] && trace->bankCycles[i] && (best < 0 || trace->bankCycles[i] > trace->bankCycles[best]))
+                best = i;
+        if (best < 0)
+            break;
+        reported[best] = true;
+        fprintf(file, "%4X  %5.1f%%\n", best, 100.0 * trace->bankCycles[best] / total);
+    }
+
+    // Single pass keeping the hottest (bank, PC) pairs sorted, code in 4000-7FFF is counted per bank
+    fputs("\nBank:PC  Cycles  Instruction\n", file);
+    struct {uint16_t bank, pc; uint32_t cycles;} hot[16];
+    uint8_t nbHot = 0;
+    for (uint16_t bank = 0; bank < cpu->mem->nbROMBanks; bank++) {
+        for (uint32_t pc = 0; pc < 0x10000; pc++) {
+            const bool romx = pc >= 0x4000 && pc < 0x8000;
+            if (bank > 0 && !romx)
+                continue;
+            const uint32_t cycles = romx ? trace->romxCycles[bank][pc - 0x4000] : trace->pcCycles[pc];
+            if (cycles == 0 || (nbHot == ARRAY_SIZE(hot) && cycles <= hot[nbHot - 1].cycles))
+                continue;
+            uint8_t i = nbHot < ARRAY_SIZE(hot) ? nbHot++ : nbHot - 1;
+            for (; i > 0 && hot[i - 1].cycles < cycles; i--)
+                hot[i] = hot[i - 1];
+            hot[i].bank = bank;
+            hot[i].pc = pc;
+            hot[i].cycles = cycles;
+        }
+    }
+
+    for (uint8_t n = 0; n < nbHot; n++) {
+        char str[16] = "";
+        for (uint16_t i = trace->next - 1, count = 0; count < (trace->wrapped ? TRACE_SIZE - 1 : trace->next); i--, count++) {
+            if (trace->entries[i].pc == hot[n].pc && trace->entries[i].bank == hot[n].bank) {
+                formatInstruction(str, trace->entries[i].opcode, trace->entries[i].operand);
+                break;
+            }
+        }
+        fprintf(file, "%3X:%4X  %5.1f%%  %s\n", hot[n].bank, hot[n].pc, 100.0 * hot[n].cycles / total, str);
+    }
+}
+
+void disassemble(FILE *trace, FILE *file) {
+    TraceEntry entry;
+    while (fread(&entry, sizeof(entry), 1, trace) == 1) {
+        char str[16];
+        formatInstruction(str, entry.opcode, entry.operand);
+        fprintf(file, "%2X %4X  %03X  %-15s %3u\n", entry.bank, entry.pc, entry.opcode, str, entry.cycles);
+    }
+}
+
+static uint32_t hashROM(const Memory *mem) {
+    // FNV-1a of the banks after the hack level patches, which the recompiled code is only valid for
+    uint32_t hash = 0x811C9DC5;
+    for (uint32_t i = 0; i < (uint32_t)mem->nbROMBanks * ROM_BANK_SIZE; i++)
+        hash = (hash ^ mem->romBanks[0][i]) * 0x01000193;
+    return hash;
+}
+
+typedef struct {
+    uint16_t bank, address, knownBank; // knownBank: last constant bank switch seen on the way, 0 if unknown
+} BlockStart;
+
+static void pushBlock(const Memory *mem, BlockStart **starts, uint32_t *nbStarts, const BlockStart *from, const uint16_t address) {
+    // Bank 0 jumps to 4000-7FFF are only followed after a "LD A,n; LD (2000-3FFF),A" bank switch
+    const uint16_t bank = address < 0x4000 ? 0 : from->bank ? from->bank : from->knownBank;
+    if (address >= 0x8000 || (address >= 0x4000 && !bank) || bank >= mem->nbROMBanks)
+        return;
+    if ((*nbStarts & (*nbStarts - 1)) == 0)
+        *starts = realloc(*starts, MAX(*nbStarts * 2, 1u) * sizeof(BlockStart));
+    (*starts)[(*nbStarts)++] = (BlockStart){bank, address, from->bank ? from->bank : from->knownBank};
+}
+
+void recompile(const Memory *mem, FILE *file) {
+    // Straight-line blocks of the code reachable from the entry point and the RST and interrupt vectors, each ending
+    // on any change of PC or IME, or in switchable banks on any write, as it might switch the bank under the code.
+    // Like the interpreter, they return after any instruction reaching the break, counting the cycles not yet given to
+    // the timers, and after memory accesses when an interrupt is to be taken.
+    uint8_t *compiled = calloc(mem->nbROMBanks, ROM_BANK_SIZE);
+    BlockStart *starts = NULL;
+    uint32_t nbStarts = 0;
+    for (uint16_t address = 0x00; address <= 0x60; address += 0x8)
+        pushBlock(mem, &starts, &nbStarts, &(BlockStart){}, address);
+    pushBlock(mem, &starts, &nbStarts, &(BlockStart){}, 0x100);
+
+    fputs("#define read(_address) blockRead(cpu->mem, _address)\n"
+          "#define write(_address, _value) blockWrite(cpu->mem, _address, _value, cpu->cycles)\n"
+          "#define push(_value) blockPush(cpu->mem, cpu->SP -= 2, _value)\n"
+          "#define pop() blockPop(cpu->mem, &cpu->SP)\n"
+          "#define addCycles(_value) cycles = _value\n\n", file);
+
+    while (nbStarts > 0) {
+        BlockStart start = starts[--nbStarts];
+        const uint8_t *rom = mem->romBanks[start.bank];
+        if (compiled[start.bank * ROM_BANK_SIZE + (start.address & 0x3FFF)])
+            continue;
+
+        uint16_t pc = start.address, pending = 0, nbInstrs = 0, lastA = 0x100;
+        bool end = false;
+        while (!end && nbInstrs < 32 && pc >> 14 == start.address >> 14 && (pc & 0x3FFF) < ROM_BANK_SIZE - 2) {
+            const uint8_t *code = &rom[pc & 0x3FFF];
+            const uint16_t opcode = code[0] == 0xCB ? 0x100 | code[1] : code[0];
+            const uint16_t operand = code[1] | code[2] << 8;
+            const Instruction *instr = &instructions[opcode];
+            if (strstr(instr->code, "UNREACHABLE") || (pc & 0x3FFF) + instr->length > ROM_BANK_SIZE)
+                break;
+
+            if (nbInstrs++ == 0) {
+                compiled[start.bank * ROM_BANK_SIZE + (start.address & 0x3FFF)] = 1;
+                fprintf(file, "static bool block_%02X_%04X(CPU *cpu, const uint64_t breakAt) {\n    UNUSED(breakAt);\n", start.bank, start.address);
+            }
+
+            char str[16], decl[64] = "";
+            formatInstruction(str, opcode, operand);
+            const uint16_t next = pc + instr->length;
+            const bool registerOnly = REGISTER_ONLY(instr->code), extraCycles = strstr(instr->code, "addCycles");
+            if (strstr(instr->code, "operand"))
+                sprintf(decl, "const uint16_t operand = 0x%04X; ", operand);
+            if (extraCycles)
+                strcat(decl, "uint8_t cycles = 0; ");
+            end = strstr(instr->code, "PC") || strstr(instr->code, "IME") || strstr(instr->code, "return") || (start.bank && strstr(instr->code, "write"));
+
+            if (registerOnly) {
+                pending += instr->length + instr->duration;
+                fprintf(file, "    {%s%s;", decl, instr->code);
+            } else {
+                if (pending)
+                    fprintf(file, "    blockTimers(cpu, %u);\n", pending);
+                pending = 0;
+                fprintf(file, "    {%scpu->PC = 0x%04X; %s;", decl, next, instr->code);
+            }
+            if (instr->flags[2] != '-')
+                fprintf(file, " applyFlags(cpu, \"%.4s\");", instr->flags);
+            if (!registerOnly)
+                fprintf(file, " blockTimers(cpu, %u%s);", instr->length + instr->duration, extraCycles ? " + cycles" : "");
+            if (registerOnly && !end)
+                fprintf(file, " if (cpu->cycles + %u >= breakAt) {cpu->PC = 0x%04X; blockTimers(cpu, %u); return false;}", pending, next, pending);
+            else if (!end)
+                fprintf(file, " if (cpu->cycles >= breakAt || (cpu->IME && cpu->mem->interruptPending)) return false;");
+            fprintf(file, "} // %04X %s\n", pc, str);
+
+            // Successors, with the bank switches of bank 0 code followed
+            if (opcode == 0x3E) {
+                lastA = operand & 0xFF;
+            } else {
+                if (opcode == 0xEA && operand >= 0x2000 && operand < 0x4000 && lastA < 0x100)
+                    start.knownBank = MAX(lastA & (mem->nbROMBanks - 1), 1);
+                lastA = 0x100;
+            }
+            if (opcode == 0x18 || opcode == 0x20 || opcode == 0x28 || opcode == 0x30 || opcode == 0x38)
+                pushBlock(mem, &starts, &nbStarts, &start, next + (int8_t)operand);
+            else if (opcode == 0xC3 || opcode == 0xC2 || opcode == 0xCA || opcode == 0xD2 || opcode == 0xDA || opcode == 0xCD || opcode == 0xC4 || opcode == 0xCC || opcode == 0xD4 || opcode == 0xDC)
+                pushBlock(mem, &starts, &nbStarts, &start, operand);
+            else if ((opcode & 0xC7) == 0xC7 && opcode < 0x100)
+                pushBlock(mem, &starts, &nbStarts, &start, opcode & 0x38);
+            else if (opcode == 0xD3 || opcode == 0xDB || opcode == 0xDD)
+                pushBlock(mem, &starts, &nbStarts, &start, pc);
+
+            if (!end || !(opcode == 0x18 || opcode == 0xC3 || opcode == 0xC9 || opcode == 0xD9 || opcode == 0xE9))
+                pushBlock(mem, &starts, &nbStarts, &start, next);
+            pc = next;
+        }
+
+        if (nbInstrs > 0) {
+            if (pending)
+                fprintf(file, "    cpu->PC = 0x%04X;\n    blockTimers(cpu, %u);\n", pc, pending);
+            fputs("    return false;\n}\n\n", file);
+        }
+    }
+
+    fputs("#undef addCycles\n#undef pop\n#undef push\n#undef write\n#undef read\n\n", file);
+
+    // Dispatch tables keyed by PC & 3FFF, for the banks with compiled code
+    for (uint16_t bank = 0; bank < mem->nbROMBanks; bank++) {
+        bool any = false;
+        for (uint16_t i = 0; i < ROM_BANK_SIZE; i++) {
+            if (compiled[bank * ROM_BANK_SIZE + i]) {
+                if (!any)
+                    fprintf(file, "static const Block bank_%02X[ROM_BANK_SIZE] = {\n", bank);
+                fprintf(file, "    [0x%04X] = block_%02X_%04X,\n", i, bank, i | (bank ? 0x4000 : 0));
+                any = true;
+            }
+        }
+        if (any)
+            fputs("};\n\n", file);
+    }
+
+    fprintf(file, "static const Block *const recompiledBanks[%u] = {\n", mem->nbROMBanks);
+    for (uint16_t bank = 0; bank < mem->nbROMBanks; bank++) {
+        bool any = false;
+        for (uint16_t i = 0; i < ROM_BANK_SIZE && !any; i++)
+            any = compiled[bank * ROM_BANK_SIZE + i];
+        if (any)
+            fprintf(file, "    [0x%02X] = bank_%02X,\n", bank, bank);
+    }
+    fprintf(file, "};\n\n#define RECOMPILED_HASH 0x%08lX\n", (unsigned long)hashROM(mem));
+
+    free(starts);
+    free(compiled);
+}
+
 static inline void applyFlags(CPU *cpu, const char flags[4]) {
     switch (flags[0]) {
         case 'A': cpu->z = (cpu->A == 0); break;
@@ -247,8 +637,8 @@ static inline void applyFlags(CPU *cpu, const char flags[4]) {
     }
 }
 
-static inline void decode(const CPU *cpu, uint16_t *opcode, uint16_t *operand) {
-    const uint8_t *mem = readp(cpu->mem, cpu->PC);
+static inline void decode(const CPU *cpu, uint16_t *opcode, uint16_t *operand, const bool bootROM) {
+    const uint8_t *mem = !bootROM && cpu->PC < 0x4000 ? &cpu->mem->rom0[cpu->PC] : readp(cpu->mem, cpu->PC);
     *opcode = *mem++;
     if (*opcode == 0xCB)
         *opcode = 0x100 | *mem;
@@ -262,10 +652,16 @@ static inline void decode(const CPU *cpu, uint16_t *opcode, uint16_t *operand) {
 #endif
 }
 
-static inline void incrTimers(CPU *cpu, const uint8_t val) {
+static inline void incrTimersFor(CPU *cpu, const uint32_t val, const bool cgb) {
     static const uint16_t timerTable[4] = {256, 4, 16, 64};
 
-    cpu->cycles += val;
+    // In double speed mode, the CPU and its timers run twice as fast as the screen, sound and DMA
+    if (!cgb || LIKELY(!cpu->doubleSpeed)) {
+        cpu->cycles += val;
+    } else {
+        cpu->cycles += (val + cpu->halfCycle) >> 1;
+        cpu->halfCycle = (val + cpu->halfCycle) & 0x1;
+    }
     if (LIKELY(!cpu->stopped)) *(uint16_t*)&cpu->mem->IO[0x03] += val << 2;
 
     if (UNLIKELY(cpu->mem->IO[0x07] & 0x4)) {
@@ -276,22 +672,57 @@ static inline void incrTimers(CPU *cpu, const uint8_t val) {
             if (__builtin_add_overflow(cpu->mem->IO[0x05], 1, &cpu->mem->IO[0x05])) {
                 cpu->mem->IO[0x05] = cpu->mem->IO[0x06];
                 cpu->mem->IO[0x0F] |= 0x4;
+                updateInterrupts(cpu->mem);
             }
 
             cpu->timer -= timerPeriod;
         }
     }
+
+    if (UNLIKELY(cpu->mem->dmaEnd) && cpu->cycles >= cpu->mem->dmaEnd) {
+        catchUpScreen(cpu->mem);
+        memcpy(cpu->mem->OAM, readp(cpu->mem, cpu->mem->dmaSource << 8), sizeof(cpu->mem->OAM));
+        cpu->mem->oamModified = true;
+        cpu->mem->dmaEnd = 0;
+    }
+}
+
+static inline void incrTimers(CPU *cpu, const uint32_t val) {
+    incrTimersFor(cpu, val, true);
+}
+
+static inline void idle(CPU *cpu, const uint64_t breakAt) {
+    if (cpu->cycles <= breakAt)
+        incrTimers(cpu, (breakAt - cpu->cycles + 1) << cpu->doubleSpeed);
+}
+
+static inline void switchSpeed(CPU *cpu) {
+    incrTimers(cpu, 2050);
+    cpu->doubleSpeed = !cpu->doubleSpeed;
+    cpu->mem->IO[0x4D] = cpu->doubleSpeed ? 0xFE : 0x7E;
+    *(uint16_t*)&cpu->mem->IO[0x03] = 0;
+}
+
+static inline void skipDMAWait(CPU *cpu, const uint64_t breakAt) {
+    // Jump to the last iteration of the standard "DEC A; JR NZ,-3" OAM DMA wait loop in HRAM, or to the break
+    const uint8_t *code = &cpu->mem->HRAM[cpu->PC & 0x7F];
+    if (cpu->PC >= 0xFF80 && cpu->PC < 0xFFFD && code[0] == 0x20 && code[1] == 0xFD && cpu->A > 1 && cpu->A <= 64 && cpu->cycles < breakAt) {
+        const uint8_t iterations = MIN(cpu->A - 1, (breakAt - cpu->cycles + 3) / 4);
+        cpu->A -= iterations;
+        incrTimers(cpu, iterations * 4);
+    }
 }
 
 static inline void interrupts(CPU *cpu) {
-    if (UNLIKELY(cpu->mem->interruptReg & cpu->mem->IO[0x0F] & 0xF)) {
-        for (uint8_t i = 0; i < 4; i++) {
+    if (UNLIKELY(cpu->mem->interruptReg & cpu->mem->IO[0x0F] & 0x1F)) {
+        for (uint8_t i = 0; i < 5; i++) {
             if (cpu->mem->interruptReg & cpu->mem->IO[0x0F] & 1 << i) {
                 cpu->stopped = cpu->halted = false;
 
                 if (cpu->IME > 0) {
                     cpu->IME = 0;
                     cpu->mem->IO[0x0F] &= ~(1 << i);
+                    updateInterrupts(cpu->mem);
                     writep(cpu->mem, cpu->SP -= 2, cpu->PC);
                     cpu->PC = 0x40 + i * 0x8;
                     incrTimers(cpu, 5);
@@ -301,39 +732,133 @@ static inline void interrupts(CPU *cpu) {
             }
         }
     }
+}
+
+#ifdef RECOMPILED
+// Called out of line by the blocks, thousands of inlined copies would take ages to compile
+static __attribute__((noinline)) uint8_t blockRead(const Memory *mem, const uint16_t address) {return read8(mem, address, true);}
+static __attribute__((noinline)) void blockWrite(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {write8(mem, address, value, cycles);}
+static __attribute__((noinline)) void blockPush(Memory *mem, const uint16_t address, const uint16_t value) {writep(mem, address, value);}
+static __attribute__((noinline)) uint16_t blockPop(const Memory *mem, uint16_t *sp) {return pop16(mem, sp);}
+static __attribute__((noinline)) void blockTimers(CPU *cpu, const uint32_t val) {incrTimers(cpu, val);}
+
+#include "recomp.inl"
 
-    cpu->IME = cpu->IME ? 1 : 0;
+static bool recompiledROM(const Memory *mem) {
+    return hashROM(mem) == RECOMPILED_HASH;
 }
 
-bool nextInstructions(CPU *cpu, const uint64_t breakAt, FILE *logFile) {
-    UNUSED(logFile);
+static inline Block findBlock(const CPU *cpu) {
+    // Banks are only looked up where they were compiled for, bank 0 in 0000-3FFF and the others in 4000-7FFF
+    const Memory *mem = cpu->mem;
+    if (cpu->PC < 0x4000) {
+        return mem->rom0 == mem->romBanks[0] && (cpu->PC >= 0x100 || mem->IO[0x50]) && recompiledBanks[0] ? recompiledBanks[0][cpu->PC] : NULL;
+    } else if (cpu->PC < 0x8000) {
+        const uint32_t bank = (mem->romx - mem->romBanks[0]) / ROM_BANK_SIZE;
+        return bank > 0 && bank < ARRAY_SIZE(recompiledBanks) && recompiledBanks[bank] ? recompiledBanks[bank][cpu->PC & 0x3FFF] : NULL;
+    }
+    return NULL;
+}
+#endif
 
-#if defined(TURBO_INTERRUPTS)
-    if (cpu->mem->interruptReg & cpu->mem->IO[0x0F] & 0xF) {
-        interrupts(cpu);
-    } else if (cpu->halted || cpu->stopped) {
-        incrTimers(cpu, breakAt - cpu->cycles + 1);
-        return true;
+#ifdef JIT
+uint8_t jitRead(CPU *cpu, const uint16_t address) {return read8(cpu->mem, address, false);}
+void jitWrite(CPU *cpu, const uint16_t address, const uint8_t value) {write8(cpu->mem, address, value, cpu->cycles);}
+void jitTimers(CPU *cpu, const uint32_t val) {incrTimers(cpu, val);}
+
+bool jitStep(CPU *cpu, const uint16_t opcode, const uint16_t operand, const uint64_t breakAt) {
+    // As interpreted, but for the timers of the register-only instructions, which the block accumulates
+    uint8_t cycles = 0;
+    uint32_t timers = 0;
+    switch (opcode) {
+        #define read(_address) read8(cpu->mem, _address, false)
+        #define write(_address, _value) write8(cpu->mem, _address, _value, cpu->cycles)
+        #define push(_value) writep(cpu->mem, cpu->SP -= 2, _value)
+        #define pop() pop16(cpu->mem, &cpu->SP)
+        #define addCycles(_value) cycles = _value;
+        #define INSTRUCTION(_opcode, _mnemonic, _length, _duration, _flags, _code) case _opcode: { \
+            cpu->PC += _length; \
+            _code; \
+            if (_flags[2] != '-') applyFlags(cpu, _flags); \
+            if (!REGISTER_ONLY(#_code)) timers = _length + _duration + cycles; \
+            break;}
+            #include "lr35902.inl"
+        #undef INSTRUCTION
+        #undef addCycles
+        #undef pop
+        #undef push
+        #undef write
+        #undef read
+        default: UNREACHABLE;
     }
+    if (timers)
+        incrTimers(cpu, timers);
+    return false;
+}
+
+static inline JitBlock* findJitBlock(const CPU *cpu) {
+    // Keyed by the bank mapped at PC like the recompiled blocks, and compiled once looked up JIT_HOT times
+    const Memory *mem = cpu->mem;
+    uint32_t bank = 0;
+    if (cpu->PC >= 0x8000 || (cpu->PC < 0x4000 && mem->rom0 != mem->romBanks[0]))
+        return NULL;
+    if (cpu->PC >= 0x4000 && ((bank = (mem->romx - mem->romBanks[0]) / ROM_BANK_SIZE) == 0 || bank >= mem->nbROMBanks))
+        return NULL;
+
+    JitBlock *banks = cpu->jit->banks[bank] ? : jitBank(cpu->jit, bank);
+    JitBlock *block = &banks[cpu->PC & 0x3FFF];
+    if (UNLIKELY(!block->code) && block->heat < JIT_HOT && ++block->heat == JIT_HOT)
+        compileBlock(cpu->jit, mem, bank, cpu->PC);
+    return block;
+}
 #endif
 
-    while (LIKELY(cpu->cycles < breakAt)) {
+static inline bool runInstructions(CPU *cpu, CPU *shared, const uint64_t breakAt, FILE *logFile, const bool generic, const bool cgb) {
+    UNUSED(shared); UNUSED(logFile);
+
+    // The batched cycles count towards the break, so that the timers never catch up past it
+    uint32_t pending = 0; UNUSED(pending);
+    while (LIKELY(cpu->cycles + pending < breakAt)) {
     #ifndef TURBO_INTERRUPTS
         if (UNLIKELY(cpu->halted || cpu->stopped)) {
-            incrTimers(cpu, 1);
+            incrTimersFor(cpu, 1, cgb);
         } else {
     #endif
+        #ifdef RECOMPILED
+            const Block block = cpu->recompiled ? findBlock(cpu) : NULL;
+            if (block) {
+                if (pending) {incrTimersFor(cpu, pending, cgb); pending = 0;}
+                *shared = *cpu;
+                const bool exited = block(shared, breakAt);
+                *cpu = *shared;
+                if (exited)
+                    return true;
+                goto executed;
+            }
+        #endif
+        #ifdef JIT
+            // Not in the generic instance, the blocks neither check for the boot ROM nor trace. Nor with an interrupt to
+            // take after this instruction, they only check for one after the instructions that can raise it. They run on
+            // the local copy, copying it to the shared one would stall on their narrow stores.
+            const JitBlock *native = !generic && cpu->jit && breakAt - cpu->cycles - pending >= JIT_NEAR ? findJitBlock(cpu) : NULL;
+            if (native && native->code && !(cpu->IME && cpu->mem->interruptPending)) {
+                pending = native->code(cpu, breakAt, pending);
+                goto executed;
+            }
+        #endif
+
             uint8_t cycles = 0; UNUSED(cycles);
             uint16_t opcode, operand = 0;
-            decode(cpu, &opcode, &operand);
+            const uint16_t pc = cpu->PC;
+            decode(cpu, &opcode, &operand, generic);
 
             switch (opcode) {
-                #define read(_address) read8(cpu->mem, _address)
-                #define write(_address, _value) write8(cpu->mem, _address, _value)
+                #define read(_address) read8(cpu->mem, _address, generic)
+                #define write(_address, _value) write8(cpu->mem, _address, _value, cpu->cycles)
                 #define push(_value) writep(cpu->mem, cpu->SP -= 2, _value)
                 #define pop() pop16(cpu->mem, &cpu->SP)
                 #if defined(DEBUG)
-                    #define addCycles(_value) incrTimers(cpu, _value)
+                    #define addCycles(_value) incrTimers(cpu, cycles = _value)
                     #define INSTRUCTION(_opcode, _mnemonic, _length, _duration, _flags, _code) case _opcode: { \
                         incrTimers(cpu, _length); \
                         cpu->PC += _length; \
@@ -353,10 +878,11 @@ bool nextInstructions(CPU *cpu, const uint64_t breakAt, FILE *logFile) {
                 #else
                     #define addCycles(_value) cycles = _value;
                     #define INSTRUCTION(_opcode, _mnemonic, _length, _duration, _flags, _code) case _opcode: { \
+                        if (!REGISTER_ONLY(#_code) && pending) {incrTimersFor(cpu, pending, cgb); pending = 0;} \
                         cpu->PC += _length; \
                         _code; \
                         if (_flags[2] != '-') applyFlags(cpu, _flags); \
-                        incrTimers(cpu, _length + _duration + cycles); \
+                        if (REGISTER_ONLY(#_code)) pending += _length + _duration; else incrTimersFor(cpu, _length + _duration + cycles, cgb); \
                         break;}
                 #endif
                     #include "lr35902.inl"
@@ -369,28 +895,77 @@ bool nextInstructions(CPU *cpu, const uint64_t breakAt, FILE *logFile) {
                 default: UNREACHABLE;
             }
 
+            if (generic && UNLIKELY(cpu->trace))
+                traceInstruction(cpu, pc, opcode, operand, instructions[opcode].length + instructions[opcode].duration + cycles);
+
             #ifdef DEBUG
             const Instruction *instr = &instructions[opcode];
             logInstruction(cpu, logFile, cpu->PC, opcode, operand, instr->mnemonic, instr->length);
             #endif
+        #if defined(RECOMPILED) || defined(JIT)
+        executed:;
+        #endif
     #ifndef TURBO_INTERRUPTS
         }
 
-        interrupts(cpu);
+        if (UNLIKELY(cpu->mem->interruptPending))
+            interrupts(cpu);
     #endif
     }
 
+    if (pending)
+        incrTimersFor(cpu, pending, cgb);
     return true;
 }
 
+bool nextInstructions(CPU *cpu, const uint64_t breakAt, FILE *logFile) {
+    if (UNLIKELY(cpu->mem->hdmaBlocks))
+        hblankDMA(cpu->mem);
+    if (UNLIKELY(cpu->mem->serialEnd) && cpu->cycles >= cpu->mem->serialEnd)
+        serialTransfer(cpu->mem);
+    updateInterrupts(cpu->mem);
+
+#if defined(TURBO_INTERRUPTS)
+    if (cpu->mem->interruptPending) {
+        interrupts(cpu);
+    } else if (cpu->halted || cpu->stopped) {
+        idle(cpu, breakAt);
+        return true;
+    }
+#endif
+
+    // The registers are kept in a copy no memory write can alias, so that they stay in host registers, and written back
+    // on exit. The compiled blocks use the shared copy.
+    CPU local = *cpu;
+    bool result;
+
+    // Specialized instances: the generic one checks for the boot ROM, tracing and double speed, the others run without
+    // them. MBCs are already dispatched once per bank switch through mem->mbc, and hack levels patch the ROM instead.
+    if (!cpu->mem->IO[0x50] || cpu->trace)
+        result = runInstructions(&local, cpu, breakAt, logFile, true, true);
+    else if (cpu->mem->cgb)
+        result = runInstructions(&local, cpu, breakAt, logFile, false, true);
+    else
+        result = runInstructions(&local, cpu, breakAt, logFile, false, false);
+
+    *cpu = local;
+    return result;
+}
+
 #ifdef THREADED_INTERPRETER
 bool nextInstructionsThreaded(CPU *cpu, const uint64_t breakAt, FILE *logFile) {
     UNUSED(logFile);
 
-    if (cpu->mem->interruptReg & cpu->mem->IO[0x0F] & 0xF) {
+    if (UNLIKELY(cpu->mem->hdmaBlocks))
+        hblankDMA(cpu->mem);
+    if (UNLIKELY(cpu->mem->serialEnd) && cpu->cycles >= cpu->mem->serialEnd)
+        serialTransfer(cpu->mem);
+    updateInterrupts(cpu->mem);
+
+    if (cpu->mem->interruptPending) {
         interrupts(cpu);
     } else if (cpu->halted || cpu->stopped) {
-        incrTimers(cpu, breakAt - cpu->cycles + 1);
+        idle(cpu, breakAt);
         return true;
     }
 
@@ -401,11 +976,11 @@ bool nextInstructionsThreaded(CPU *cpu, const uint64_t breakAt, FILE *logFile) {
     };
 
     uint16_t opcode, operand = 0;
-    decode(cpu, &opcode, &operand);
+    decode(cpu, &opcode, &operand, true);
     goto *instrs[opcode];
 
-    #define read(_address) read8(cpu->mem, _address)
-    #define write(_address, _value) write8(cpu->mem, _address, _value)
+    #define read(_address) read8(cpu->mem, _address, true)
+    #define write(_address, _value) write8(cpu->mem, _address, _value, cpu->cycles)
     #define push(_value) writep(cpu->mem, cpu->SP -= 2, _value)
     #define pop() pop16(cpu->mem, &cpu->SP)
     #define addCycles(_value) cycles = _value;
@@ -416,7 +991,7 @@ bool nextInstructionsThreaded(CPU *cpu, const uint64_t breakAt, FILE *logFile) {
         if (_flags[2] != '-') applyFlags(cpu, _flags); \
         incrTimers(cpu, _length + _duration + cycles); \
         if (cpu->cycles >= breakAt) return true; \
-        decode(cpu, &opcode, &operand); \
+        decode(cpu, &opcode, &operand, true); \
         goto *instrs[opcode];}
         #include "lr35902.inl"
     #undef INSTRUCTION
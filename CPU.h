@@ -3,6 +3,24 @@
 #include "memory.h"
 #include <stdio.h>
 
+#define TRACE_SIZE 0x10000
+
+// Executed instruction, the bank is the ROM bank mapped at 4000-7FFF for code there, 0 otherwise
+typedef struct {
+    uint16_t pc, operand, bank;
+    uint16_t opcode:9, cycles:7;
+} TraceEntry;
+
+typedef struct {
+    uint16_t next; // wraps with TRACE_SIZE
+    bool wrapped;
+    TraceEntry entries[TRACE_SIZE];
+    uint32_t pcCycles[0x10000], bankCycles[512]; // pcCycles is unused in 4000-7FFF
+    uint32_t (*romxCycles)[ROM_BANK_SIZE]; // per ROM bank, for code in 4000-7FFF
+} Trace;
+
+typedef struct Jit Jit;
+
 typedef struct {
     union {
         uint16_t AF;
@@ -27,9 +45,11 @@ typedef struct {
     };
     uint16_t SP, PC, timer;
     uint8_t IME;
-    bool stopped, halted;
+    bool stopped, halted, doubleSpeed, halfCycle, recompiled;
 
     Memory *mem;
+    Trace *trace; // NULL when not tracing
+    Jit *jit; // native blocks, NULL when not built with JIT
 
     uint64_t cycles;
 
@@ -38,7 +58,21 @@ typedef struct {
 #endif
 } CPU;
 
-CPU initCPU(const char *cartridge, const bool bootSequence, const uint8_t hackLevel) WARN_UNUSED_RESULT;
+CPU initCPU(const char *cartridge, const bool bootSequence, const uint8_t hackLevel, const bool cgb) WARN_UNUSED_RESULT;
 void deleteCPU(CPU *cpu);
 
+// Instructions only touching the registers, checked on their code at compile time. Their cycles are accumulated and
+// the timers caught up once, before the next instruction that can observe them.
+#define REGISTER_ONLY(_code) (!strstr(_code, "read(") && !strstr(_code, "write") && !strstr(_code, "push(") && !strstr(_code, "pop(") && \
+    !strstr(_code, "mem") && !strstr(_code, "PC") && !strstr(_code, "IME") && !strstr(_code, "(cpu,") && !strstr(_code, "return") && !strstr(_code, "Cycles"))
+
 bool nextInstructions(CPU *cpu, const uint64_t breakAt, FILE *logFile);
+
+Trace* initTrace(const Memory *mem) WARN_UNUSED_RESULT;
+void deleteTrace(Trace *trace);
+void writeTrace(const CPU *cpu, FILE *file);
+void reportHotSpots(const CPU *cpu, FILE *file);
+void disassemble(FILE *trace, FILE *file);
+
+// Writes the code reachable in the ROM as C, for a build with RECOMPILED defined, see the README
+void recompile(const Memory *mem, FILE *file);
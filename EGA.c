@@ -0,0 +1,453 @@
+#include "ega.h"
+#include <dpmi.h>
+#include <pc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/nearptr.h>
+#include <time.h>
+
+#ifdef DEBUG
+    #define inline __attribute__((noinline))
+#else
+    #define inline inline __attribute__((always_inline))
+#endif
+
+static inline bool setMode(const uint16_t n) {
+    // http://www.faqs.org/faqs/msdos-programmer-faq/part4/section-5.html
+    __dpmi_regs regs = {.h.ah = 0x12, .h.bl = 0x32};
+    __dpmi_int(0x10, &regs);
+    __dpmi_int(0x10, &(__dpmi_regs){.x.ax = n});
+    return regs.h.al == 0x12;
+}
+
+static inline void tweakTimings() {
+/*
+    outportb(0x3D4, 0x00); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x01); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x02); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x03); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x04); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x05); printf("%X\n", inportw(0x3D4));
+
+    outportb(0x3D4, 0x06); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x07); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x09); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x10); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x11); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x12); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x15); printf("%X ", inportw(0x3D4));
+    outportb(0x3D4, 0x16); printf("%X\n", inportw(0x3D4));
+//*/
+    // wiki.osdev.org/VGA_Hardware
+    // https://pdos.csail.mit.edu/6.828/2014/readings/hardware/vgadoc/VGAREGS.TXT
+    outportb(0x3C2, 0xE3); // 640x480 (25 MHz, negative-negative)
+/*
+    const uint16_t vTotal = 525;
+    const uint16_t vDisplayEnd = 480 - 1;
+    const uint16_t vBlankingStart = vDisplayEnd + 1;
+    const uint16_t vRetraceStart = vTotal - 36;
+    const uint16_t vRetraceEnd = vTotal - 34;
+    const uint16_t vBlankingEnd = vTotal - 1;
+/*/
+    const uint16_t vTotal = 525;
+    const uint16_t vDisplayEnd = 288 - 1;
+    const uint16_t vBlankingStart = vDisplayEnd + 0;
+    const uint16_t vRetraceStart = vTotal - 132;
+    const uint16_t vRetraceEnd = vTotal - 1;
+    const uint16_t vBlankingEnd = vTotal - 1;
+//*/
+    outportw(0x3D4, 0x11 | (vRetraceEnd & 0xF) << 8); // vertical retrace end and indices 0-7 write enable
+    outportw(0x3D4, 0x06 | ((vTotal - 2) & 0xFF) << 8); // vertical total
+    outportw(0x3D4, 0x07 | (0x3E) << 8); // overflow register
+    outportw(0x3D4, 0x09 | (0xC0) << 8); // start vertical blanking (2)
+    outportw(0x3D4, 0x10 | (vRetraceStart & 0xFF) << 8); // vertical retrace start
+    outportw(0x3D4, 0x12 | (vDisplayEnd & 0xFF) << 8); // vertical display end
+    outportw(0x3D4, 0x15 | (vBlankingStart & 0xFF) << 8); // start vertical blanking
+    outportw(0x3D4, 0x16 | (vBlankingEnd & 0xFF) << 8); // end vertical blanking
+/*
+    const uint8_t hTotal = 50;
+    const uint8_t hDisplayEnd = 40 - 1;
+    const uint8_t hBlankingStart = hDisplayEnd + 1;
+    const uint8_t hRetraceStart = hTotal - 5;
+    const uint8_t hRetraceEnd = hTotal - 1;
+    const uint8_t hBlankingEnd = hTotal - 1;
+/*/
+    const uint8_t hTotal = 50;
+    const uint8_t hDisplayEnd = 20 - 1;
+    const uint8_t hBlankingStart = hDisplayEnd + 1;
+    const uint8_t hRetraceStart = hTotal - 15;
+    const uint8_t hRetraceEnd = hTotal - 1;
+    const uint8_t hBlankingEnd = hTotal - 1;
+//*/
+    outportw(0x3D4, 0x00 | (hTotal - 5) << 8); // horizontal total
+    outportw(0x3D4, 0x01 | hDisplayEnd << 8); // horizontal display end
+    outportw(0x3D4, 0x02 | hBlankingStart << 8); // start horizontal blanking
+    outportw(0x3D4, 0x03 | 0x8000 | (hBlankingEnd & 0x1F) << 8); // end horizontal blanking
+    outportw(0x3D4, 0x04 | hRetraceStart << 8); // horizontal retrace start
+    outportw(0x3D4, 0x05 | (hRetraceEnd & 0x1F) << 8 | (hBlankingEnd & 0x20) << 2); // horizontal retrace end
+
+    outportw(0x3D4, 0x13 | 10 << 8); // scanline byte count / 2
+}
+
+static inline void setColor(const uint8_t i, const uint8_t c) {
+    outportb(0x3C0, i); outportb(0x3C0, ((c & 0x1) ? 0 : 0x38) | ((c & 0x2) ? 0 : 0x07));
+}
+
+static inline void updateColorPalettes(Screen *screen) {
+    // 5-bit to 6-bit DAC levels
+    static const uint8_t levels[32] = {
+        0x00, 0x02, 0x04, 0x06, 0x08, 0x0A, 0x0C, 0x0E, 0x10, 0x12, 0x14, 0x16, 0x18, 0x1A, 0x1C, 0x1E,
+        0x21, 0x23, 0x25, 0x27, 0x29, 0x2B, 0x2D, 0x2F, 0x31, 0x33, 0x35, 0x37, 0x39, 0x3B, 0x3D, 0x3F,
+    };
+
+    // The layers of the planes only leave room for BG palette 0 and OBJ palettes 0 and 1, loaded in DAC colors 16-31
+    const uint16_t *palettes[3] = {(const uint16_t*)screen->palettes[0], (const uint16_t*)screen->palettes[1], (const uint16_t*)&screen->palettes[1][8]};
+    const uint8_t slots[3] = {16, 24, 28};
+    for (uint8_t p = 0; p < 3; p++) {
+        outportb(0x3C8, slots[p]);
+        for (uint8_t c = 0; c < 4; c++) {
+            const uint16_t color = palettes[p][c];
+            outportb(0x3C9, levels[color & 0x1F]); outportb(0x3C9, levels[color >> 5 & 0x1F]); outportb(0x3C9, levels[color >> 10 & 0x1F]);
+        }
+    }
+
+    *screen->palettesModified = false;
+}
+
+static inline void updatePalette(Screen *screen) {
+    if (screen->cgb) {
+        if (*screen->palettesModified) updateColorPalettes(screen);
+        return;
+    }
+
+    bool modified = false;
+
+    if (screen->currPalette[0] != screen->IO[0x47]) {
+        screen->currPalette[0] = screen->IO[0x47];
+        inportb(0x3DA);
+        modified = true;
+
+        const uint8_t palette[4] = {screen->IO[0x47] & 0x3, screen->IO[0x47] >> 2 & 0x3, screen->IO[0x47] >> 4 & 0x3, screen->IO[0x47] >> 6};
+        for (uint8_t c = 0; c < 4; c++)
+            setColor(c, palette[c]);
+    }
+
+    if (screen->currPalette[1] != screen->IO[0x48]) {
+        screen->currPalette[1] = screen->IO[0x48];
+        if (!modified) inportb(0x3DA);
+        modified = true;
+
+        const uint8_t palette[3] = {screen->IO[0x48] >> 2 & 0x3, screen->IO[0x48] >> 4 & 0x3, screen->IO[0x48] >> 6};
+        for (uint8_t c = 0; c < 3; c++)
+            setColor(c + 9, palette[c]);
+    }
+
+    if (screen->currPalette[2] != screen->IO[0x49]) {
+        screen->currPalette[2] = screen->IO[0x49];
+        if (!modified) inportb(0x3DA);
+        modified = true;
+
+        const uint8_t palette[3] = {screen->IO[0x49] >> 2 & 0x3, screen->IO[0x49] >> 4 & 0x3, screen->IO[0x49] >> 6};
+        for (uint8_t c = 0; c < 3; c++)
+            setColor(c + 13, palette[c]);
+    }
+
+    if (modified) {
+        outportb(0x3C0, 0x0C); outportb(0x3C0, 0x08);
+        outportb(0x3C0, 0x2C); outportb(0x3C0, 0x08);
+    }
+}
+
+static inline bool paletteModified(const Screen *screen) {
+    return screen->cgb ? *screen->palettesModified : memcmp(screen->currPalette, &screen->IO[0x47], 3) != 0;
+}
+
+static inline void syncRaster(const Screen *screen, const uint8_t y) {
+    // Each Game Boy line is scanned twice, and the first one comes 1 line after the end of the vertical retrace
+    const uint64_t vgaLine = UCLOCKS_PER_SEC * 800ull / 25175000;
+    const uint64_t lineStart = screen->frameStart + vgaLine * (2 * y + 1);
+    while ((uint64_t)uclock() < lineStart - vgaLine / 2);
+    while (!(inportb(0x3DA) & 0x1));
+}
+
+static inline void selectPlanes(Screen *screen, const uint8_t mask) {
+    if (screen->planeMask != mask) {
+        screen->planeMask = mask;
+        outportw(0x3C4, mask << 8 | 0x02);
+    }
+}
+
+static inline void clear(Screen *screen) {
+    uint8_t *pixels = (uint8_t*)0xA0000 + __djgpp_conventional_base;
+    selectPlanes(screen, 0x0F);
+    memset(pixels, 0, 20 * 144);
+}
+
+void setPalette(Screen *screen, const bool originalColors) {
+    static const uint8_t defaultPalette[2][4][3] = {
+        {{0x38, 0x38, 0x38}, {0x28, 0x28, 0x28}, {0x18, 0x18, 0x18}, {0x08, 0x08, 0x08}},
+        {{0x20, 0x26, 0x14}, {0x16, 0x20, 0x12}, {0x0C, 0x1A, 0x10}, {0x02, 0x14, 0x0E}},
+    };
+
+    if (screen->originalColors != originalColors) {
+        screen->originalColors = originalColors;
+        outportb(0x3C8,  0); outportb(0x3C9, defaultPalette[originalColors][3][0]); outportb(0x3C9, defaultPalette[originalColors][3][1]); outportb(0x3C9, defaultPalette[originalColors][3][2]);
+        outportb(0x3C8, 56); outportb(0x3C9, defaultPalette[originalColors][2][0]); outportb(0x3C9, defaultPalette[originalColors][2][1]); outportb(0x3C9, defaultPalette[originalColors][2][2]);
+        outportb(0x3C8,  7); outportb(0x3C9, defaultPalette[originalColors][1][0]); outportb(0x3C9, defaultPalette[originalColors][1][1]); outportb(0x3C9, defaultPalette[originalColors][1][2]);
+        outportb(0x3C8, 63); outportb(0x3C9, defaultPalette[originalColors][0][0]); outportb(0x3C9, defaultPalette[originalColors][0][1]); outportb(0x3C9, defaultPalette[originalColors][0][2]);
+    }
+}
+
+void setTitle(Screen *screen, const char *title) {
+    UNUSED(screen); UNUSED(title);
+}
+
+static inline uint8_t flipBits(uint8_t row) {
+    row = (row >> 1 & 0x55) | (row & 0x55) << 1;
+    row = (row >> 2 & 0x33) | (row & 0x33) << 2;
+    return row >> 4 | row << 4;
+}
+
+static inline void renderCell(Screen *screen, const uint8_t map, const uint8_t row, const uint8_t column) {
+    // Both bit planes of the tile rows, CGB attributes from VRAM bank 1 select the tile bank and flips
+    const uint16_t tilesBase = screen->IO[0x40] & 0x10 ? 0x0 : 0x1000;
+    const uint16_t index = 0x1800 + (map << 10) + (row << 5) + column;
+    const uint8_t tileOffset = screen->VRAM[index], attributes = screen->cgb ? screen->VRAM[RAM_SIZE + index] : 0;
+    uint16_t address = tilesBase + ((tilesBase ? (int8_t)tileOffset : tileOffset) << 4);
+    if (attributes & 0x40) address += 0xE;
+    if (attributes & 0x08) address += RAM_SIZE;
+
+    screen->mapCache->attributes[map][row][column] = attributes & 0x87;
+    uint16_t *rows = &screen->mapCache->rows[map][row << 3][column];
+    for (uint8_t y = 0; y < 8; y++, rows += 32, address += attributes & 0x40 ? -2 : 2)
+        *rows = attributes & 0x20 ? flipBits(screen->VRAM[address]) | flipBits(screen->VRAM[address + 1]) << 8 : *(const uint16_t*)&screen->VRAM[address];
+}
+
+static inline void updateMapCache(Screen *screen) {
+    // Cells are rendered again when their index or attributes are written, when their tile is, and for all of them
+    // when the tile data area changes
+    MapCache *cache = screen->mapCache;
+    DirtyVRAM *dirty = screen->dirtyVRAM;
+    if (cache->tileData != (screen->IO[0x40] & 0x10)) {
+        cache->tileData = screen->IO[0x40] & 0x10;
+        memset(cache->dirty, 0xFF, sizeof(cache->dirty));
+    }
+    if (!dirty->modified)
+        return;
+
+    static const uint32_t noTiles[ARRAY_SIZE(dirty->tiles)];
+    if (memcmp(dirty->tiles, noTiles, sizeof(noTiles)) != 0) {
+        for (uint16_t index = 0; index < 0x800; index++) {
+            const uint8_t tileOffset = screen->VRAM[0x1800 + index];
+            uint16_t tile = cache->tileData ? tileOffset : 256 + (int8_t)tileOffset;
+            if (screen->cgb && screen->VRAM[RAM_SIZE + 0x1800 + index] & 0x08) tile += 384;
+            if (dirty->tiles[tile >> 5] >> (tile & 0x1F) & 0x1) cache->dirty[index >> 10][index >> 5 & 0x1F] |= 1u << (index & 0x1F);
+        }
+        memset(dirty->tiles, 0, sizeof(dirty->tiles));
+    }
+
+    for (uint8_t map = 0; map < 2; map++)
+        for (uint8_t row = 0; row < 32; row++)
+            cache->dirty[map][row] |= dirty->cells[map][row];
+    memset(dirty->cells, 0, sizeof(dirty->cells));
+    dirty->modified = false;
+}
+
+static inline const uint16_t* mapRow(Screen *screen, const uint8_t map, const uint8_t y) {
+    uint32_t *dirty = &screen->mapCache->dirty[map][y >> 3];
+    for (; *dirty; *dirty &= *dirty - 1)
+        renderCell(screen, map, y >> 3, __builtin_ctz(*dirty));
+    return screen->mapCache->rows[map][y];
+}
+
+static inline const uint8_t* mapAttributes(const Screen *screen, const uint8_t map, const uint8_t y) {
+    return screen->cgb ? screen->mapCache->attributes[map][y >> 3] : NULL;
+}
+
+static void drawPixels(Screen *screen, const uint8_t x, const uint8_t y, const uint8_t wy, const uint8_t nbPixels) {
+    volatile uint8_t *linePixels = (uint8_t*)0xA0000 + __djgpp_conventional_base + y * 20;
+    uint8_t (*shadow)[20] = screen->lineShadow, *priorities = screen->linePriority;
+    const uint32_t modified = (2u << ((x + nbPixels - 1) >> 3)) - (1u << (x >> 3));
+    updateMapCache(screen);
+
+    inline void put(const uint8_t b, const uint8_t mask, const uint8_t plane0, const uint8_t plane1, const uint8_t priority) {
+        shadow[0][b] ^= (shadow[0][b] ^ plane0) & mask;
+        shadow[1][b] ^= (shadow[1][b] ^ plane1) & mask;
+        shadow[2][b] &= ~mask;
+        shadow[3][b] &= ~mask;
+        priorities[b] ^= (priorities[b] ^ priority) & mask;
+    }
+
+    inline void draw(const uint16_t *row, const uint8_t *attributes, uint8_t p, uint8_t x, uint8_t nbPixels) {
+        // The 8 pixels of the cached map row around x, which wraps around with the map
+        inline uint16_t tile(const uint8_t x) {
+            return row[x >> 3];
+        }
+
+        // The same 8 pixels for the cells drawn over the sprites, from xt pixels into the cell of x1
+        inline uint8_t priority(const uint8_t x1, const uint8_t x2, const uint8_t xt) {
+            return attributes ? (attributes[x1 >> 3] & 0x80 ? 0xFF << xt : 0) | (attributes[x2 >> 3] & 0x80 ? 0xFF >> (8 - xt) : 0) : 0;
+        }
+
+        if (nbPixels == 0)
+            return;
+
+        uint16_t tileRow = tile(x);
+        if (p & 0x7) {
+            // Spans shorter than the rest of the byte stop within it
+            const uint8_t pt = p & 0x7, head = MIN(8 - pt, nbPixels);
+            tileRow = tile(x - pt);
+            const uint16_t tileRow2 = tile(x + 8 - pt);
+            const uint8_t xt = (x - pt) & 0x7;
+            put(p >> 3, 0xFF >> pt & 0xFF << (8 - pt - head), (uint8_t)tileRow << xt | (uint8_t)tileRow2 >> (8 - xt), tileRow >> 8 << xt | tileRow2 >> 8 >> (8 - xt), priority(x - pt, x + 8 - pt, xt));
+            tileRow = tileRow2;
+            x += head; p += head; nbPixels -= head;
+        }
+
+        for (; nbPixels >= 8; p += 8, nbPixels -= 8) {
+            const uint16_t tileRow2 = tile(x += 8);
+            const uint8_t xt = x & 0x7;
+            put(p >> 3, 0xFF, (uint8_t)tileRow << xt | (uint8_t)tileRow2 >> (8 - xt), tileRow >> 8 << xt | tileRow2 >> 8 >> (8 - xt), priority(x - 8, x, xt));
+            tileRow = tileRow2;
+        }
+
+        if (nbPixels > 0) {
+            const uint16_t tileRow2 = tile(x + 8);
+            const uint8_t xt = x & 0x7;
+            put(p >> 3, 0xFF << (8 - nbPixels), (uint8_t)tileRow << xt | (uint8_t)tileRow2 >> (8 - xt), tileRow >> 8 << xt | tileRow2 >> 8 >> (8 - xt), priority(x, x + 8, xt));
+        }
+    }
+
+    const bool window = windowEnabled(screen, y);
+    const uint8_t xw = window ? MAX((int16_t)x, screen->IO[0x4B] - 7) : 160;
+    const uint8_t countw = MAX(0, MIN(160, (int16_t)x + nbPixels) - xw);
+    if (window && countw > 0) {
+        const uint8_t map = screen->IO[0x40] >> 6 & 0x1;
+        draw(mapRow(screen, map, wy - 1), mapAttributes(screen, map, wy - 1), xw, xw + 7 - screen->IO[0x4B], countw);
+    }
+
+    if (xw > 0) {
+        static const uint16_t blank[32];
+        const bool background = screen->cgb || screen->IO[0x40] & 0x1;
+        const uint8_t map = screen->IO[0x40] >> 3 & 0x1;
+        if (background)
+            draw(mapRow(screen, map, y + screen->IO[0x42]), mapAttributes(screen, map, y + screen->IO[0x42]), x, x + screen->IO[0x43], MIN(nbPixels, xw - x));
+        else
+            draw(blank, NULL, x, x + screen->IO[0x43], MIN(nbPixels, xw - x));
+    }
+
+    const bool spritesEnabled = screen->IO[0x40] & 0x2;
+    if (spritesEnabled) {
+        const bool bigSprites = (screen->IO[0x40] & 0x4) != 0;
+        const uint8_t spritesHeight = bigSprites ? 16 : 8;
+        const bool backgroundPriority = !screen->cgb || screen->IO[0x40] & 0x1;
+
+        // The other pixels of the bytes belong to the spans before or after, composed with their own background
+        inline uint8_t spanMask(const uint8_t b) {
+            const int16_t first = MAX(0, x - (b << 3)), last = MIN(8, x + nbPixels - (b << 3));
+            return first < last ? 0xFF >> first & 0xFF << (8 - last) : 0;
+        }
+
+        // Behind the background, sprites only show on its color 0 (also excluding the sprites under them), and so do
+        // all sprites on the CGB cells drawn over them, unless LCDC bit 0 clears the priorities
+        inline void compose(const uint8_t b, uint8_t mask, const uint8_t plane0, const uint8_t plane1, const bool priority, const bool palette) {
+            mask &= spanMask(b);
+            const uint8_t hidden = !backgroundPriority ? 0 : priority ? shadow[0][b] | shadow[1][b] | shadow[2][b] | shadow[3][b] : priorities[b] & (shadow[0][b] | shadow[1][b]) & ~shadow[3][b];
+            const uint8_t visible = mask & ~hidden;
+            shadow[0][b] ^= (shadow[0][b] ^ plane0) & visible;
+            shadow[1][b] ^= (shadow[1][b] ^ plane1) & visible;
+            shadow[2][b] = palette ? shadow[2][b] | visible : shadow[2][b] & ~visible;
+            shadow[3][b] |= visible;
+        }
+
+        for (int8_t i = screen->visibleSprites - 1; i >= 0; i--) {
+            const Sprite s = screen->sprites[i];
+            if (s.x <= x || s.x >= x + nbPixels + 8)
+                continue;
+
+            const uint8_t spriteId = bigSprites ? (s.tile & 0xFE) : s.tile;
+            const uint8_t ys = s.yflip ? spritesHeight - y + s.y - 17 : y - s.y + 16;
+            const uint8_t *tileRow = &screen->VRAM[(screen->cgb && s.bank ? RAM_SIZE : 0) + (spriteId << 4) + (ys << 1)];
+
+            uint8_t row1 = tileRow[0], row2 = tileRow[1];
+            if (s.xflip) {row1 = flipBits(row1); row2 = flipBits(row2);}
+            const bool palette = screen->cgb ? s.cgbPalette & 0x1 : s.palette;
+
+            const int16_t p = s.x - 8;
+            const uint8_t pt = p & 0x7, mask = row1 | row2;
+            if (s.x >= 8)
+                compose(p >> 3, mask >> pt, row1 >> pt, row2 >> pt, s.priority, palette);
+            if (pt && s.x < 160)
+                compose((p >> 3) + 1, mask << (8 - pt), row1 << (8 - pt), row2 << (8 - pt), s.priority, palette);
+        }
+    }
+
+    // The bytes of the span, whole and one plane after the other, starting from the selected one
+    const uint8_t first = __builtin_ctz(modified), count = 32 - __builtin_clz(modified) - first;
+    for (uint8_t i = 0, plane = __builtin_ctz(screen->planeMask) & 0x3; i < 4; i++, plane = (plane + 1) & 0x3) {
+        selectPlanes(screen, 1 << plane);
+        memcpy((void*)linePixels + first, &shadow[plane][first], count);
+    }
+}
+
+static void startFrame(Screen *screen, const bool draw) {
+    if (!screen->turbo) while (!(inportb(0x3DA) & 0x8));
+    if (draw) updatePalette(screen);
+    if (!screen->turbo) while (inportb(0x3DA) & 0x8);
+    screen->frameStart = uclock();
+}
+
+static void startLine(Screen *screen, const uint8_t y) {
+    if (screen->rasterPalettes && !screen->turbo && paletteModified(screen)) {
+        // Apply mid-frame palette changes during the horizontal blanking preceding the line
+        syncRaster(screen, y);
+        updatePalette(screen);
+    }
+}
+
+static void closeEGA(Screen *screen) {
+    free(screen->mapCache);
+    __djgpp_nearptr_disable();
+    setMode(0x3);
+}
+
+static const Display ega = {.startFrame = startFrame, .startLine = startLine, .drawPixels = drawPixels, .clear = clear, .close = closeEGA};
+
+Screen initScreen(Memory *mem, const bool journal, const uint8_t pixelBatch) {
+    // The timing and registers of a headless screen, drawn on the EGA planes
+    Screen screen = initHeadlessScreen(mem);
+    screen.display = &ega;
+    screen.turbo = false;
+    screen.pixelBatch = pixelBatch;
+    screen.journal = journal ? &mem->journal : NULL;
+    screen.palettesModified = &mem->palettesModified;
+    screen.dirtyVRAM = &mem->dirtyVRAM;
+    memset(screen.currPalette, 0xFF, sizeof(screen.currPalette));
+    screen.mapCache = malloc(sizeof(MapCache));
+    screen.mapCache->tileData = 0xFF;
+
+    if (setMode(0xD))
+        tweakTimings();
+
+    __djgpp_nearptr_enable();
+
+    setPalette(&screen, true);
+    if (screen.cgb) {
+        // Each color of the planes selects its own DAC color
+        inportb(0x3DA);
+        for (uint8_t c = 0; c < 16; c++) {
+            outportb(0x3C0, c); outportb(0x3C0, 16 + c);
+        }
+        outportb(0x3C0, 0x20);
+    }
+    updatePalette(&screen);
+
+    // Lines are composed in system RAM and copied whole bytes at a time, one plane after the other
+    outportw(0x3CE, 0x0001); // disable set/reset
+    outportw(0x3CE, 0x0005); // write mode 0
+    outportw(0x3CE, 0xFF08); // all bits
+    outportw(0x3C4, 0x0F02); // all planes
+    screen.planeMask = 0x0F;
+
+    return screen;
+}
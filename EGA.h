@@ -0,0 +1,9 @@
+#pragma once
+
+#include "screen.h"
+
+// A screen drawn on the EGA planes, with the timing of the headless one
+Screen initScreen(Memory *mem, const bool journal, const uint8_t pixelBatch) WARN_UNUSED_RESULT;
+
+void setTitle(Screen *screen, const char *title);
+void setPalette(Screen *screen, const bool originalColors);
@@ -0,0 +1,35 @@
+#include "export.h"
+#include <string.h>
+
+ExportFrame* beginExport(ExportRing *ring) {
+    ExportFrame *frame = &ring->frames[ring->published % EXPORT_FRAMES];
+    __atomic_store_n(&frame->sequence, frame->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return frame;
+}
+
+void endExport(ExportRing *ring, const uint8_t *IO, const uint8_t (*cgbPalettes)[64]) {
+    ExportFrame *frame = &ring->frames[ring->published % EXPORT_FRAMES];
+    memcpy(frame->palettes, &IO[0x47], sizeof(frame->palettes));
+    memcpy(frame->cgbPalettes, cgbPalettes, sizeof(frame->cgbPalettes));
+    memcpy(frame->sound, &IO[0x10], sizeof(frame->sound));
+    __atomic_store_n(&frame->sequence, frame->sequence + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->published, ring->published + 1, __ATOMIC_RELEASE);
+}
+
+const ExportFrame* acquireFrame(const ExportRing *ring, uint32_t *sequence) {
+    // Latest complete frame, NULL before the first one
+    const uint32_t published = __atomic_load_n(&ring->published, __ATOMIC_ACQUIRE);
+    if (published == 0)
+        return NULL;
+
+    const ExportFrame *frame = &ring->frames[(published - 1) % EXPORT_FRAMES];
+    *sequence = __atomic_load_n(&frame->sequence, __ATOMIC_ACQUIRE);
+    return *sequence & 0x1 ? NULL : frame;
+}
+
+bool releaseFrame(const ExportFrame *frame, const uint32_t sequence) {
+    // False when the producer wrapped around and overwrote the frame while it was read
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&frame->sequence, __ATOMIC_RELAXED) == sequence;
+}
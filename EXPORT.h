@@ -0,0 +1,25 @@
+#pragma once
+
+#include "global.h"
+
+#define EXPORT_FRAMES 4
+
+// Pixels are the color index (bits 0-1) and its layer (bits 2-3: 0 background/window, 2 OBP0, 3 OBP1), like the
+// EGA planes, and in CGB mode the palette number (bits 4-6) from the BG attributes or the sprite. Palettes are BGP,
+// OBP0 and OBP1, CGB ones the BG and OBJ palette RAM, and sound the APU registers FF10-FF3F, at the end of the frame.
+typedef struct {
+    uint32_t sequence; // odd while the frame is written
+    uint8_t pixels[144][160], palettes[3], cgbPalettes[2][64], sound[0x30];
+} ExportFrame;
+
+// Single producer ring, read in place by any number of consumers
+typedef struct {
+    uint32_t published;
+    ExportFrame frames[EXPORT_FRAMES];
+} ExportRing;
+
+ExportFrame* beginExport(ExportRing *ring);
+void endExport(ExportRing *ring, const uint8_t *IO, const uint8_t (*cgbPalettes)[64]);
+
+const ExportFrame* acquireFrame(const ExportRing *ring, uint32_t *sequence);
+bool releaseFrame(const ExportFrame *frame, const uint32_t sequence);
@@ -0,0 +1,161 @@
+#include "gbdos.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STATE_MAGIC 0x53444247 // "GBDS"
+
+GameBoy* initGameBoy(const char *rom, const uint8_t hackLevel, const bool cgb) {
+    GameBoy *gb = calloc(1, sizeof(GameBoy));
+    gb->cpu = initCPU(rom, false, hackLevel, cgb);
+    gb->screen = initHeadlessScreen(gb->cpu.mem);
+    return gb;
+}
+
+void deleteGameBoy(GameBoy **gb) {
+    free((*gb)->screen.export);
+    deleteScreen(&(*gb)->screen);
+    deleteCPU(&(*gb)->cpu);
+    free(*gb);
+}
+
+void runFrame(GameBoy *gb) {
+    while (!nextPixels(&gb->screen, false))
+        nextInstructions(&gb->cpu, gb->screen.cycles, NULL);
+}
+
+void runCycles(GameBoy *gb, const uint32_t cycles) {
+    // The screen runs ahead of the CPU, which catches up to it or to the end, whichever comes first
+    const uint64_t end = gb->cpu.cycles + cycles;
+    while (gb->cpu.cycles < end) {
+        if (gb->cpu.cycles >= gb->screen.cycles)
+            nextPixels(&gb->screen, false);
+        nextInstructions(&gb->cpu, MIN(gb->screen.cycles, end), NULL);
+    }
+}
+
+void setInput(GameBoy *gb, const uint8_t buttons) {
+    const uint8_t pressed = ~((gb->cpu.mem->buttons[0] & 0xF) | gb->cpu.mem->buttons[1] << 4);
+    if (buttons & ~pressed) gb->cpu.mem->IO[0x0F] |= 0x10;
+    gb->cpu.mem->buttons[0] = 0x30 | (~buttons & 0xF);
+    gb->cpu.mem->buttons[1] = 0x30 | (~buttons >> 4 & 0xF);
+}
+
+void connectLink(GameBoy *gb1, GameBoy *gb2) {
+    gb1->cpu.mem->peer = gb2->cpu.mem;
+    gb2->cpu.mem->peer = gb1->cpu.mem;
+}
+
+void runLinked(GameBoy *gb1, GameBoy *gb2, const uint32_t cycles) {
+    for (uint32_t done = 0; done < cycles; done += SERIAL_CLKS) {
+        runCycles(gb1, MIN((uint32_t)SERIAL_CLKS, cycles - done));
+        runCycles(gb2, MIN((uint32_t)SERIAL_CLKS, cycles - done));
+    }
+}
+
+const ExportRing* startExport(GameBoy *gb) {
+    if (!gb->screen.export)
+        gb->screen.export = calloc(1, sizeof(ExportRing));
+    return gb->screen.export;
+}
+
+bool saveState(const GameBoy *gb, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    // Raw structures, only meant to be loaded back by the same build. The host pointers are left out, loading keeps
+    // those of the running instance.
+    const Memory *mem = gb->cpu.mem;
+    CPU cpu = gb->cpu;
+    cpu.mem = NULL;
+    cpu.trace = NULL;
+    cpu.jit = NULL;
+    Memory *copy = malloc(sizeof(Memory));
+    *copy = *mem;
+    copy->romBanks = NULL;
+    copy->externalRAM = NULL;
+    copy->rom0 = copy->romx = NULL;
+    copy->ramBank = copy->sram = copy->vramBank = copy->wramBank = NULL;
+    copy->mbc = NULL;
+    copy->peer = NULL;
+    copy->keys = NULL;
+    copy->lateLines = (LateLines){};
+
+    const uint32_t header[3] = {STATE_MAGIC, sizeof(CPU), sizeof(Memory)};
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(&cpu, sizeof(CPU), 1, file);
+    fwrite(copy, sizeof(Memory), 1, file);
+    free(copy);
+    fwrite(mem->externalRAM, RAM_SIZE, MAX(1, mem->nbRAMBanks), file);
+    fwrite(&gb->screen.cycles, sizeof(gb->screen.cycles), 1, file);
+    fwrite(&gb->screen.event, sizeof(gb->screen.event), 1, file);
+    fwrite(&gb->screen.line, sizeof(gb->screen.line), 1, file);
+    fwrite(&gb->screen.dot, sizeof(gb->screen.dot), 1, file);
+    fwrite(&gb->screen.wy, sizeof(gb->screen.wy), 1, file);
+    fwrite(&gb->screen.delay, sizeof(gb->screen.delay), 1, file);
+    const bool ok = fwrite(&gb->screen.enabled, sizeof(gb->screen.enabled), 1, file) == 1;
+
+    fclose(file);
+    return ok;
+}
+
+bool loadState(GameBoy *gb, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    uint32_t header[3];
+    Memory *mem = gb->cpu.mem;
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != STATE_MAGIC || header[1] != sizeof(CPU) || header[2] != sizeof(Memory)) {
+        fclose(file);
+        return false;
+    }
+
+    // The pointers of the running instance are kept, the banks are then mapped again from the restored registers
+    uint8_t (*romBanks)[ROM_BANK_SIZE] = mem->romBanks, (*externalRAM)[RAM_SIZE] = mem->externalRAM;
+    const Controller *mbc = mem->mbc;
+    Memory *peer = mem->peer;
+    KeyEvents *keys = mem->keys;
+    Trace *trace = gb->cpu.trace;
+    Jit *jit = gb->cpu.jit;
+    const LateLines lateLines = {.draw = mem->lateLines.draw};
+    const uint16_t nbROMBanks = mem->nbROMBanks;
+    const uint8_t nbRAMBanks = mem->nbRAMBanks;
+    char savePath[sizeof(mem->savePath)];
+    strcpy(savePath, mem->savePath);
+
+    bool ok = fread(&gb->cpu, sizeof(CPU), 1, file) == 1 && fread(mem, sizeof(Memory), 1, file) == 1;
+    gb->cpu.mem = mem;
+    gb->cpu.trace = trace;
+    gb->cpu.jit = jit;
+    mem->romBanks = romBanks;
+    mem->externalRAM = externalRAM;
+    mem->mbc = mbc;
+    mem->peer = peer;
+    mem->keys = keys;
+    mem->lateLines = lateLines;
+    gb->screen.lateStart = gb->screen.lateEnd;
+    ok = ok && mem->nbROMBanks == nbROMBanks && mem->nbRAMBanks == nbRAMBanks;
+    mem->nbROMBanks = nbROMBanks;
+    mem->nbRAMBanks = nbRAMBanks;
+    strcpy(mem->savePath, savePath);
+    mem->vramBank = mem->VRAM[mem->cgb ? mem->IO[0x4F] & 0x1 : 0];
+    mem->wramBank = mem->internalRAM[mem->cgb ? (mem->IO[0x70] & 0x7) ? : 1 : 1];
+    mem->mbc->map(mem);
+    mem->oamModified = mem->palettesModified = true;
+    memset(mem->dirtyVRAM.cells, 0xFF, sizeof(mem->dirtyVRAM.cells));
+    mem->dirtyVRAM.modified = true;
+
+    const size_t ramBanks = MAX(1, nbRAMBanks);
+    ok = ok && fread(externalRAM, RAM_SIZE, ramBanks, file) == ramBanks;
+    ok = ok && fread(&gb->screen.cycles, sizeof(gb->screen.cycles), 1, file) == 1;
+    ok = ok && fread(&gb->screen.event, sizeof(gb->screen.event), 1, file) == 1;
+    ok = ok && fread(&gb->screen.line, sizeof(gb->screen.line), 1, file) == 1;
+    ok = ok && fread(&gb->screen.dot, sizeof(gb->screen.dot), 1, file) == 1;
+    ok = ok && fread(&gb->screen.wy, sizeof(gb->screen.wy), 1, file) == 1;
+    ok = ok && fread(&gb->screen.delay, sizeof(gb->screen.delay), 1, file) == 1;
+    ok = ok && fread(&gb->screen.enabled, sizeof(gb->screen.enabled), 1, file) == 1;
+
+    fclose(file);
+    return ok;
+}
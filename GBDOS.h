@@ -0,0 +1,34 @@
+#pragma once
+
+#include "cpu.h"
+#include "screen.h"
+
+// libgbdos: a headless Game Boy, driven by the host. Video and sound are left to the host, from the VRAM, OAM and
+// IO registers in cpu.mem, nothing touches the PC hardware.
+
+typedef enum {
+    BUTTON_A = 0x01, BUTTON_B = 0x02, BUTTON_SELECT = 0x04, BUTTON_START = 0x08,
+    BUTTON_RIGHT = 0x10, BUTTON_LEFT = 0x20, BUTTON_UP = 0x40, BUTTON_DOWN = 0x80,
+} Button;
+
+typedef struct {
+    CPU cpu;
+    Screen screen;
+} GameBoy;
+
+GameBoy* initGameBoy(const char *rom, const uint8_t hackLevel, const bool cgb) WARN_UNUSED_RESULT;
+void deleteGameBoy(GameBoy **gb);
+
+void runFrame(GameBoy *gb);
+void runCycles(GameBoy *gb, const uint32_t cycles);
+void setInput(GameBoy *gb, const uint8_t buttons);
+
+// Publishes every completed frame to a ring that consumers read in place, see export.h
+const ExportRing* startExport(GameBoy *gb);
+
+// Link cable between two instances, run in alternating slices no longer than a serial transfer
+void connectLink(GameBoy *gb1, GameBoy *gb2);
+void runLinked(GameBoy *gb1, GameBoy *gb2, const uint32_t cycles);
+
+bool saveState(const GameBoy *gb, const char *path);
+bool loadState(GameBoy *gb, const char *path);
@@ -0,0 +1,751 @@
+#include "jit.h"
+
+#ifdef JIT
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE  (8 << 20)
+#define JIT_BLOCK_SIZE (32 << 10) // room left before compiling a block, more than its longest code
+#define JIT_COLD_SIZE  (12 << 10) // of its slow paths
+#define JIT_INSTRS     32
+#define JIT_ROOM       1024 // of slow paths left before translating an instruction, more than its longest ones
+
+// Host registers: the CPU in rbp, its memory in r12, the flag table in r13, SP in r14w and the budget in r15, the
+// cycles left to the break, which the calls preserve, then A in al, BC in bx, DE in dx and HL in cx, stored in the CPU
+// around the calls. ah, esi and edi are scratch. The high byte registers can't be encoded with a REX prefix, so no
+// instruction mixes them with the registers past rdi or with sil, and memory values pass through ah. The stack holds
+// the cycles the block was entered with, which the budget excludes until the timers are given them, and breakAt.
+enum {RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R12 = 12, R13, R14, R15};
+enum {AL, CL, DL, BL, AH, CH, DH, BH};
+enum {JMP = -1, CC_C = 0x2, CC_NC = 0x3, CC_Z = 0x4, CC_NZ = 0x5, CC_NA = 0x6, CC_LE = 0xE};
+
+// Host register of the register fields of the opcodes, B, C, D, E, H, L, (HL) and A, and of the pairs BC, DE, HL, SP
+static const uint8_t reg8[8] = {BH, BL, DH, DL, CH, CL, 0xFF, AL};
+static const uint8_t reg16[4] = {RBX, RDX, RCX, R14};
+
+#define CPU_(_field) (int32_t)offsetof(CPU, _field)
+#define MEM_(_field) (int32_t)offsetof(Memory, _field)
+
+static const struct {
+    uint8_t length, duration;
+    const char *code;
+} instructions[512] = {
+    #define INSTRUCTION(_opcode, _mnemonic, _length, _duration, _flags, _code) {_length, _duration, #_code},
+    #include "lr35902.inl"
+    #undef INSTRUCTION
+};
+
+typedef struct {
+    uint8_t *jump;
+    uint16_t pc, pending; // PC to set unless the step did, and the cycles returned to the interpreter
+    bool setPC, carry; // carry adds the ones the block was entered with
+} Exit;
+
+typedef struct {
+    uint8_t *rel; // of a jump between the block and its slow paths
+    uint8_t *target; // in the other one
+} Fixup;
+
+typedef struct {
+    uint8_t *p, *body;
+    Exit exits[JIT_INSTRS * 4 + 8]; // emitted after the epilogue, out of the straight line
+    uint8_t nbExits;
+    uint8_t cold[JIT_COLD_SIZE], *c, *hot; // slow paths, copied after the block, and where they return
+    Fixup fixups[JIT_INSTRS * 24];
+    uint16_t nbFixups;
+    JitBlock *blocks; // of the bank, to chain to
+    bool carry; // the cycles the block was entered with are not given to the timers yet
+    const uint8_t *bank; // mapping the block was compiled for
+    bool rom0;
+} Emitter;
+
+static void emit(Emitter *e, const uint8_t *bytes, const uint8_t size) {
+    memcpy(e->p, bytes, size);
+    e->p += size;
+}
+
+#define EMIT(...) emit(e, (const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void imm16(Emitter *e, const uint16_t value) {emit(e, (const uint8_t*)&value, 2);}
+static void imm32(Emitter *e, const uint32_t value) {emit(e, (const uint8_t*)&value, 4);}
+static void imm64(Emitter *e, const uint64_t value) {emit(e, (const uint8_t*)&value, 8);}
+
+static void modrm(Emitter *e, const uint8_t reg, const uint8_t base, const int32_t disp) {
+    // [base + disp], with base rbp or r12, the REX bits are left to the caller
+    const bool near = disp >= -128 && disp < 128;
+    EMIT((near ? 0x40 : 0x80) | (reg & 0x7) << 3 | (base & 0x7));
+    if ((base & 0x7) == RSP) EMIT(0x24);
+    if (near) EMIT(disp); else imm32(e, disp);
+}
+
+static uint8_t* jump(Emitter *e, const int8_t cc) {
+    if (cc == JMP) EMIT(0xE9); else EMIT(0x0F, 0x80 | cc);
+    e->p += 4;
+    return e->p - 4;
+}
+
+static void land(Emitter *e, uint8_t *rel) {
+    const int32_t offset = e->p - (rel + 4);
+    memcpy(rel, &offset, 4);
+}
+
+static void outOfLine(Emitter *e, uint8_t *const *from, const uint8_t nbFrom) {
+    // Continue with the slow path the jumps from lead to, emitted apart so that the straight line falls through
+    for (uint8_t i = 0; i < nbFrom; i++)
+        if (from[i])
+            e->fixups[e->nbFixups++] = (Fixup){from[i], e->c};
+    e->hot = e->p;
+    e->p = e->c;
+}
+
+static void inLine(Emitter *e) {
+    // Back to the straight line after the slow path
+    e->fixups[e->nbFixups++] = (Fixup){jump(e, JMP), e->hot};
+    e->c = e->p;
+    e->p = e->hot;
+}
+
+static void store(Emitter *e, const bool all) {
+    // The registers the calls don't preserve, and with all, the ones a step can change
+    EMIT(0x88); modrm(e, AL, RBP, CPU_(A));
+    EMIT(0x66, 0x89); modrm(e, RDX, RBP, CPU_(DE));
+    EMIT(0x66, 0x89); modrm(e, RCX, RBP, CPU_(HL));
+    if (all) {
+        EMIT(0x66, 0x89); modrm(e, RBX, RBP, CPU_(BC));
+        EMIT(0x66, 0x44, 0x89); modrm(e, R14, RBP, CPU_(SP));
+    }
+}
+
+static void load(Emitter *e, const bool all) {
+    // A is loaded in al alone, ah can hold a result
+    EMIT(0x8A); modrm(e, AL, RBP, CPU_(A));
+    EMIT(0x66, 0x8B); modrm(e, RDX, RBP, CPU_(DE));
+    EMIT(0x66, 0x8B); modrm(e, RCX, RBP, CPU_(HL));
+    if (all) {
+        EMIT(0x66, 0x8B); modrm(e, RBX, RBP, CPU_(BC));
+        EMIT(0x66, 0x44, 0x8B); modrm(e, R14, RBP, CPU_(SP));
+    }
+}
+
+static void call(Emitter *e, const void *function) {
+    // The arguments after the CPU are already in esi, edx and rcx
+    EMIT(0x48, 0x89, 0xEF);
+    EMIT(0x48, 0xB8); imm64(e, (uintptr_t)function);
+    EMIT(0xFF, 0xD0);
+}
+
+static void leave(Emitter *e, const int8_t cc, const bool setPC, const uint16_t pc, const uint16_t pending) {
+    e->exits[e->nbExits++] = (Exit){jump(e, cc), pc, pending, setPC, e->carry};
+}
+
+static void budget(Emitter *e) {
+    // On entry, and after the calls that can give cycles to the timers
+    EMIT(0x4C, 0x8B, 0x7C, 0x24, 0x08);
+    EMIT(0x4C, 0x2B); modrm(e, R15, RBP, CPU_(cycles));
+    if (e->carry) EMIT(0x4C, 0x2B, 0x3C, 0x24);
+}
+
+static void timers(Emitter *e, const uint32_t val) {
+    // Inline unless in double speed or with the timer or an OAM DMA running, the cases jitTimers handles. The first
+    // call adds the cycles the block was entered with.
+    const bool carry = e->carry;
+    if (val == 0 && !carry)
+        return;
+    e->carry = false;
+    uint8_t *none = NULL;
+    if (carry) {
+        EMIT(0x8B, 0x34, 0x24);
+        EMIT(0x81, 0xC6); imm32(e, val);
+        if (val == 0) none = jump(e, CC_Z);
+    }
+    uint8_t *slow[4];
+    EMIT(0x80); modrm(e, 7, RBP, CPU_(doubleSpeed)); EMIT(0x00);
+    slow[0] = jump(e, CC_NZ);
+    EMIT(0x49, 0x83); modrm(e, 7, R12, MEM_(dmaEnd)); EMIT(0x00);
+    slow[1] = jump(e, CC_NZ);
+    EMIT(0x41, 0xF6); modrm(e, 0, R12, MEM_(IO) + 0x07); EMIT(0x04);
+    uint8_t *running = jump(e, CC_NZ);
+
+    // With the timer running, out of line, the cycles are added to it, and TIMA ticked once unless it overflows, the
+    // period is kept on the stack
+    outOfLine(e, &running, 1);
+    EMIT(0x41, 0x0F, 0xB6); modrm(e, RDI, R12, MEM_(IO) + 0x07);
+    EMIT(0x83, 0xE7, 0x03);
+    EMIT(0x41, 0x0F, 0xB7, 0xBC, 0x7D); imm32(e, offsetof(Jit, periods) - offsetof(Jit, flags));
+    EMIT(0x89, 0x7C, 0x24, 0x10);
+    EMIT(0x66, 0x2B); modrm(e, RDI, RBP, CPU_(timer));
+    if (carry) EMIT(0x39, 0xF7); else {EMIT(0x81, 0xFF); imm32(e, val);}
+    uint8_t *tick = jump(e, CC_NA);
+    if (carry) {EMIT(0x66, 0x01); modrm(e, RSI, RBP, CPU_(timer));}
+    else if (val < 0x80) {EMIT(0x66, 0x83); modrm(e, 0, RBP, CPU_(timer)); EMIT(val);}
+    else {EMIT(0x66, 0x81); modrm(e, 0, RBP, CPU_(timer)); imm16(e, val);}
+    uint8_t *ticked = jump(e, JMP);
+    land(e, tick);
+    EMIT(0xF7, 0xDF);
+    if (carry) EMIT(0x01, 0xF7); else {EMIT(0x81, 0xC7); imm32(e, val);}
+    EMIT(0x3B, 0x7C, 0x24, 0x10);
+    slow[2] = jump(e, CC_NC);
+    EMIT(0x41, 0x80); modrm(e, 7, R12, MEM_(IO) + 0x05); EMIT(0xFF);
+    slow[3] = jump(e, CC_Z);
+    EMIT(0x41, 0xFE); modrm(e, 0, R12, MEM_(IO) + 0x05);
+    EMIT(0x66, 0x89); modrm(e, RDI, RBP, CPU_(timer));
+    land(e, ticked);
+    inLine(e);
+    if (carry) {
+        EMIT(0x48, 0x01); modrm(e, RSI, RBP, CPU_(cycles));
+        EMIT(0x8D, 0x3C, 0xB5); imm32(e, 0);
+        EMIT(0x66, 0x41, 0x01); modrm(e, RDI, R12, MEM_(IO) + 0x03);
+    } else if (val < 0x20) {
+        EMIT(0x48, 0x83); modrm(e, 0, RBP, CPU_(cycles)); EMIT(val);
+        EMIT(0x66, 0x41, 0x83); modrm(e, 0, R12, MEM_(IO) + 0x03); EMIT(val << 2);
+    } else {
+        EMIT(0x48, 0x81); modrm(e, 0, RBP, CPU_(cycles)); imm32(e, val);
+        EMIT(0x66, 0x41, 0x81); modrm(e, 0, R12, MEM_(IO) + 0x03); imm16(e, val << 2);
+    }
+    if (val) {
+        if (val < 0x80) {EMIT(0x49, 0x83, 0xEF, val);} else {EMIT(0x49, 0x81, 0xEF); imm32(e, val);}
+    }
+
+    outOfLine(e, slow, ARRAY_SIZE(slow));
+    store(e, false);
+    if (!carry) {EMIT(0xBE); imm32(e, val);}
+    call(e, jitTimers);
+    load(e, false);
+    budget(e);
+    inLine(e);
+    if (none)
+        land(e, none);
+}
+
+static void guard(Emitter *e, const bool setPC, const uint16_t pc) {
+    // Leave after a write switching the bank under the block
+    EMIT(0x48, 0xBE); imm64(e, (uintptr_t)e->bank);
+    EMIT(0x49, 0x39); modrm(e, RSI, R12, e->rom0 ? MEM_(rom0) : MEM_(romx));
+    leave(e, CC_NZ, setPC, pc, 0);
+}
+
+static void stop(Emitter *e, const bool setPC, const uint16_t pc) {
+    // Leave with an interrupt to take or at the break, as the interpreter would after the instruction
+    EMIT(0x80); modrm(e, 7, RBP, CPU_(IME)); EMIT(0x00);
+    uint8_t *disabled = jump(e, CC_Z);
+    EMIT(0x41, 0x80); modrm(e, 7, R12, MEM_(interruptPending)); EMIT(0x00);
+    leave(e, CC_NZ, setPC, pc, 0);
+    land(e, disabled);
+    EMIT(0x4D, 0x85, 0xFF);
+    leave(e, CC_LE, setPC, pc, 0);
+}
+
+static void address(Emitter *e, const uint8_t pair) {
+    // Game Boy address in esi, from bx, dx or cx
+    EMIT(0x0F, 0xB7, 0xF0 | pair);
+}
+
+static void constant(Emitter *e, const uint16_t address) {
+    EMIT(0xBE); imm32(e, address);
+}
+
+static void wram(Emitter *e, uint8_t *slow[2]) {
+    // Host address of a C000-DFFF access in rsi, unless an OAM DMA makes it read FF and drop writes
+    EMIT(0x8D, 0xBE); imm32(e, -0xC000);
+    EMIT(0x81, 0xFF); imm32(e, 0x2000);
+    slow[0] = jump(e, CC_NC);
+    EMIT(0x49, 0x83); modrm(e, 7, R12, MEM_(dmaEnd)); EMIT(0x00);
+    slow[1] = jump(e, CC_NZ);
+    EMIT(0x81, 0xFF); imm32(e, 0x1000);
+    uint8_t *bank = jump(e, CC_NC);
+    EMIT(0x49, 0x8D, 0xB4, 0x3C); imm32(e, MEM_(internalRAM));
+    uint8_t *done = jump(e, JMP);
+    land(e, bank);
+    EMIT(0x49, 0x8B); modrm(e, RSI, R12, MEM_(wramBank));
+    EMIT(0x48, 0x01, 0xFE);
+    EMIT(0x48, 0x81, 0xEE); imm32(e, 0x1000);
+    land(e, done);
+}
+
+static void read(Emitter *e, const bool known, const uint16_t at) {
+    // Value at the address in esi into ah, directly for WRAM and ROM, through read8 otherwise. With known, the address
+    // is the constant at and only its path is emitted.
+    uint8_t *slow[4] = {};
+    uint8_t *fast = NULL;
+    if (!known || (at >= 0xC000 && at < 0xE000)) {
+        wram(e, slow);
+        fast = jump(e, JMP);
+    }
+    if (!known || at < 0x8000) {
+        if (slow[0])
+            land(e, slow[0]);
+        EMIT(0x81, 0xFE); imm32(e, 0x8000);
+        slow[0] = jump(e, CC_NC);
+        EMIT(0x49, 0x83); modrm(e, 7, R12, MEM_(dmaEnd)); EMIT(0x00);
+        slow[2] = jump(e, CC_NZ);
+        EMIT(0x81, 0xFE); imm32(e, 0x4000);
+        uint8_t *romx = jump(e, CC_NC);
+        EMIT(0x49, 0x8B); modrm(e, RDI, R12, MEM_(rom0));
+        uint8_t *add = jump(e, JMP);
+        land(e, romx);
+        EMIT(0x49, 0x8B); modrm(e, RDI, R12, MEM_(romx));
+        EMIT(0x48, 0x81, 0xEE); imm32(e, 0x4000);
+        land(e, add);
+        EMIT(0x48, 0x01, 0xFE);
+        if (fast)
+            land(e, fast);
+        fast = e->p;
+    } else if (fast) {
+        land(e, fast);
+        fast = e->p;
+    }
+
+    if (fast) {
+        EMIT(0x8A, 0x26);
+        outOfLine(e, slow, ARRAY_SIZE(slow));
+    }
+    store(e, false);
+    call(e, jitRead);
+    EMIT(0x88, 0xC4);
+    load(e, false);
+    if (fast)
+        inLine(e);
+}
+
+static void write(Emitter *e, const bool known, const uint16_t at, const uint8_t src, const uint8_t value) {
+    // The register src, or value when src is 0xFF, to the address in esi, directly for WRAM, through write8 otherwise
+    uint8_t *slow[2] = {};
+    const bool fast = !known || (at >= 0xC000 && at < 0xE000);
+    if (fast) {
+        wram(e, slow);
+        if (src != 0xFF) EMIT(0x88, src << 3 | RSI); else EMIT(0xC6, 0x06, value);
+        outOfLine(e, slow, ARRAY_SIZE(slow));
+    }
+    store(e, false);
+    if (src != 0xFF) EMIT(0x0F, 0xB6, 0xD0 | src); else {EMIT(0xBA); imm32(e, value);}
+    call(e, jitWrite);
+    load(e, false);
+    if (fast)
+        inLine(e);
+}
+
+static void arithmeticFlags(Emitter *e, const bool sub, const bool keepCarry) {
+    // Z, H and C from the x86 ZF, AF and CF, C kept for INC and DEC
+    EMIT(0x9F);
+    EMIT(0x0F, 0xB6, 0xF4);
+    EMIT(0x41, 0x0F, 0xB6, 0xB4, 0x35); imm32(e, sub ? 256 : 0);
+    if (keepCarry) {
+        EMIT(0x83, 0xE6, 0xE0);
+        EMIT(0x80); modrm(e, 4, RBP, CPU_(F)); EMIT(0x10);
+        EMIT(0x40, 0x08); modrm(e, RSI, RBP, CPU_(F));
+    } else {
+        EMIT(0x40, 0x88); modrm(e, RSI, RBP, CPU_(F));
+    }
+}
+
+static void zeroFlag(Emitter *e, const uint8_t others, const bool keepCarry) {
+    // Z from the x86 ZF, N, H and C from others, or C kept
+    EMIT(0x0F, 0x94, 0xC4);
+    EMIT(0xC0, 0xE4, 0x07);
+    if (others) EMIT(0x80, 0xCC, others);
+    if (keepCarry) {
+        EMIT(0x80); modrm(e, 4, RBP, CPU_(F)); EMIT(0x10);
+        EMIT(0x08); modrm(e, AH, RBP, CPU_(F));
+    } else {
+        EMIT(0x88); modrm(e, AH, RBP, CPU_(F));
+    }
+}
+
+static void carryIn(Emitter *e) {
+    // x86 CF from C, F read alone as it was just stored alone
+    EMIT(0x0F, 0xB6); modrm(e, RSI, RBP, CPU_(F));
+    EMIT(0x0F, 0xBA, 0xE6, 0x04);
+}
+
+static void alu(Emitter *e, const uint8_t op, const uint8_t src, const bool immediate, const uint8_t value) {
+    // ADD, ADC, SUB, SBC, AND, XOR, OR and CP to their x86 equivalent on al
+    static const uint8_t x86[8] = {0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38};
+    if (op == 1 || op == 3)
+        carryIn(e);
+    if (immediate) EMIT(x86[op] + 4, value); else EMIT(x86[op], 0xC0 | src << 3 | AL);
+    if (op >= 4 && op <= 6)
+        zeroFlag(e, op == 4 ? 0x20 : 0, false);
+    else
+        arithmeticFlags(e, op >= 2, false);
+}
+
+static void rotate(Emitter *e, const uint8_t op, const uint8_t reg, const bool zero) {
+    // CB RLC, RRC, RL, RR, SLA, SRA, SWAP and SRL, and RLCA, RRCA, RLA and RRA without zero
+    static const uint8_t x86[8] = {0, 1, 2, 3, 4, 7, 0xFF, 5};
+    if (op == 6) {
+        EMIT(0xC0, 0xC8 | reg, 0x04);
+        EMIT(0x84, 0xC0 | reg << 3 | reg);
+        zeroFlag(e, 0, false);
+        return;
+    }
+    if (op == 2 || op == 3)
+        carryIn(e);
+    EMIT(0xD0, 0xC0 | x86[op] << 3 | reg);
+    EMIT(0x0F, 0x92, 0xC4);
+    EMIT(0xC0, 0xE4, 0x04);
+    if (zero) {
+        EMIT(0x84, 0xC0 | reg << 3 | reg);
+        EMIT(0x75, 0x03);
+        EMIT(0x80, 0xCC, 0x80);
+    }
+    EMIT(0x88); modrm(e, AH, RBP, CPU_(F));
+}
+
+static void testBit(Emitter *e, const uint8_t reg, const uint8_t bit) {
+    EMIT(0xF6, 0xC0 | reg, 1 << bit);
+    zeroFlag(e, 0x20, true);
+}
+
+static bool translate(Emitter *e, const uint16_t opcode, const uint16_t operand) {
+    // Native code for the common instructions, the others are stepped through the interpreter
+    const uint8_t x = opcode >> 3 & 0x7, z = opcode & 0x7;
+    if (opcode >= 0x100) {
+        if (opcode < 0x140) {
+            if (z == 6)
+                return false;
+            rotate(e, x, reg8[z], true);
+        } else if (opcode < 0x180) {
+            if (z == 6) {
+                address(e, RCX);
+                read(e, false, 0);
+            }
+            testBit(e, z == 6 ? AH : reg8[z], x);
+        } else if (z != 6) {
+            if (opcode < 0x1C0) EMIT(0x80, 0xE0 | reg8[z], ~(1 << x)); else EMIT(0x80, 0xC8 | reg8[z], 1 << x);
+        } else {
+            address(e, RCX);
+            read(e, false, 0);
+            if (opcode < 0x1C0) EMIT(0x80, 0xE4, ~(1 << x)); else EMIT(0x80, 0xCC, 1 << x);
+            address(e, RCX);
+            write(e, false, 0, AH, 0);
+        }
+        return true;
+    }
+
+    if (opcode >= 0x40 && opcode < 0x80) {
+        if (z == 6) {
+            address(e, RCX);
+            read(e, false, 0);
+            EMIT(0x88, 0xC0 | AH << 3 | reg8[x]);
+        } else if (x == 6) {
+            address(e, RCX);
+            write(e, false, 0, reg8[z], 0);
+        } else if (x != z) {
+            EMIT(0x88, 0xC0 | reg8[z] << 3 | reg8[x]);
+        }
+        return true;
+    }
+    if (opcode >= 0x80 && opcode < 0xC0) {
+        if (z == 6) {
+            address(e, RCX);
+            read(e, false, 0);
+        }
+        alu(e, x, z == 6 ? AH : reg8[z], false, 0);
+        return true;
+    }
+    if ((opcode & 0xC7) == 0xC6) {
+        alu(e, x, 0, true, operand);
+        return true;
+    }
+    if ((opcode & 0xC7) == 0x06 && x != 6) {
+        EMIT(0xB0 | reg8[x], operand);
+        return true;
+    }
+    if ((opcode & 0xC6) == 0x04 && x != 6) {
+        EMIT(0xFE, (z == 4 ? 0xC0 : 0xC8) | reg8[x]);
+        arithmeticFlags(e, z == 5, true);
+        return true;
+    }
+    if (opcode == 0x34 || opcode == 0x35) {
+        // LAHF would overwrite the value in ah, H is set when the low nibble wrapped
+        address(e, RCX);
+        read(e, false, 0);
+        EMIT(0xFE, opcode == 0x34 ? 0xC4 : 0xCC);
+        EMIT(0x40, 0x0F, 0x94, 0xC6);
+        EMIT(0x40, 0xC0, 0xE6, 0x07);
+        EMIT(0x0F, 0xB6, 0xFC);
+        if (opcode == 0x35) EMIT(0xF7, 0xD7);
+        EMIT(0x83, 0xE7, 0x0F);
+        EMIT(0x83, 0xFF, 0x01);
+        EMIT(0x19, 0xFF);
+        EMIT(0x83, 0xE7, 0x20);
+        EMIT(0x09, 0xFE);
+        if (opcode == 0x35) EMIT(0x83, 0xCE, 0x40);
+        EMIT(0x80); modrm(e, 4, RBP, CPU_(F)); EMIT(0x10);
+        EMIT(0x40, 0x08); modrm(e, RSI, RBP, CPU_(F));
+        address(e, RCX);
+        write(e, false, 0, AH, 0);
+        return true;
+    }
+    if ((opcode & 0xCF) == 0x01) {
+        if (reg16[x >> 1] == R14) EMIT(0x66, 0x41, 0xBE); else EMIT(0x66, 0xB8 | reg16[x >> 1]);
+        imm16(e, operand);
+        return true;
+    }
+    if ((opcode & 0xC7) == 0x03) {
+        if (reg16[x >> 1] == R14) EMIT(0x66, 0x41, 0xFF); else EMIT(0x66, 0xFF);
+        EMIT((opcode & 0x8 ? 0xC8 : 0xC0) | (reg16[x >> 1] & 0x7));
+        return true;
+    }
+
+    switch (opcode) {
+        case 0x00: return true;
+        case 0x07: case 0x0F: case 0x17: case 0x1F: rotate(e, x, AL, false); return true;
+        case 0x2F: EMIT(0xF6, 0xD0); EMIT(0x80); modrm(e, 1, RBP, CPU_(F)); EMIT(0x60); return true;
+        case 0x37: EMIT(0x80); modrm(e, 4, RBP, CPU_(F)); EMIT(0x80); EMIT(0x80); modrm(e, 1, RBP, CPU_(F)); EMIT(0x10); return true;
+        case 0x3F: EMIT(0x80); modrm(e, 6, RBP, CPU_(F)); EMIT(0x10); EMIT(0x80); modrm(e, 4, RBP, CPU_(F)); EMIT(0x90); return true;
+        case 0x0A: case 0x1A: case 0x2A: case 0x3A:
+            address(e, opcode == 0x0A ? RBX : opcode == 0x1A ? RDX : RCX);
+            read(e, false, 0);
+            EMIT(0x88, 0xE0);
+            if (opcode == 0x2A) EMIT(0x66, 0xFF, 0xC1); else if (opcode == 0x3A) EMIT(0x66, 0xFF, 0xC9);
+            return true;
+        case 0x02: case 0x12: case 0x22: case 0x32:
+            address(e, opcode == 0x02 ? RBX : opcode == 0x12 ? RDX : RCX);
+            write(e, false, 0, AL, 0);
+            if (opcode == 0x22) EMIT(0x66, 0xFF, 0xC1); else if (opcode == 0x32) EMIT(0x66, 0xFF, 0xC9);
+            return true;
+        case 0x36: address(e, RCX); write(e, false, 0, 0xFF, operand); return true;
+        case 0xFA: constant(e, operand); read(e, true, operand); EMIT(0x88, 0xE0); return true;
+        case 0xEA: constant(e, operand); write(e, true, operand, AL, 0); return true;
+        case 0xF0: EMIT(0x41, 0x8A); modrm(e, AL, R12, MEM_(IO) + (operand & 0xFF)); return true;
+        case 0xF2: EMIT(0x0F, 0xB6, 0xF3); EMIT(0x41, 0x8A, 0x84, 0x34); imm32(e, MEM_(IO)); return true;
+        case 0xE0:
+            if ((operand & 0xFF) >= 0x80 && (operand & 0xFF) != 0xFF) {
+                EMIT(0x41, 0x88); modrm(e, AL, R12, MEM_(HRAM) + (operand & 0x7F));
+            } else {
+                constant(e, 0xFF00 | operand);
+                write(e, true, 0xFF00 | operand, AL, 0);
+            }
+            return true;
+        case 0xE2: EMIT(0x0F, 0xB6, 0xF3); EMIT(0x81, 0xC6); imm32(e, 0xFF00); write(e, true, 0xFF00, AL, 0); return true;
+        default: return false;
+    }
+}
+
+static void step(Emitter *e, const uint16_t pc, const uint16_t opcode, const uint16_t operand) {
+    store(e, true);
+    EMIT(0x66, 0xC7); modrm(e, 0, RBP, CPU_(PC)); imm16(e, pc);
+    EMIT(0xBE); imm32(e, opcode);
+    EMIT(0xBA); imm32(e, operand);
+    EMIT(0x48, 0x8B, 0x4C, 0x24, 0x08);
+    call(e, jitStep);
+    load(e, true);
+    budget(e);
+}
+
+static void chain(Emitter *e, const bool known, const uint16_t pc, const uint16_t start) {
+    // Unless the interpreter would stop, jump to the block at PC, known or set by a step, once compiled for the bank
+    // this one runs in, or loop back to the start of this one
+    stop(e, known, pc);
+    if (known && pc == start) {
+        EMIT(0x48, 0xC7, 0x04, 0x24); imm32(e, 0);
+        EMIT(0xE9); imm32(e, e->body - (e->p + 4));
+        return;
+    }
+    if (known) {
+        EMIT(0x48, 0xBE); imm64(e, (uintptr_t)&e->blocks[pc & 0x3FFF].body);
+    } else {
+        EMIT(0x0F, 0xB7); modrm(e, RSI, RBP, CPU_(PC));
+        EMIT(0x89, 0xF7);
+        EMIT(0xC1, 0xEF, 0x0E);
+        EMIT(0x83, 0xFF, start >> 14);
+        leave(e, CC_NZ, false, 0, 0);
+        EMIT(0x81, 0xE6); imm32(e, 0x3FFF);
+        EMIT(0x69, 0xF6); imm32(e, sizeof(JitBlock));
+        EMIT(0x48, 0xBF); imm64(e, (uintptr_t)&e->blocks[0].body);
+        EMIT(0x48, 0x01, 0xFE);
+    }
+    EMIT(0x48, 0x8B, 0x36);
+    EMIT(0x48, 0x85, 0xF6);
+    leave(e, CC_Z, known, pc, 0);
+    EMIT(0x48, 0xC7, 0x04, 0x24); imm32(e, 0);
+    EMIT(0xFF, 0xE6);
+}
+
+static void jumpTo(Emitter *e, const uint16_t pc, const uint32_t cycles, const uint16_t start) {
+    // To another bank or to RAM, the interpreter finds the block
+    timers(e, cycles);
+    if (pc >> 14 == start >> 14) chain(e, true, pc, start); else leave(e, JMP, true, pc, 0);
+}
+
+static bool branch(Emitter *e, const uint16_t opcode, const uint16_t operand, const uint16_t next, const uint32_t cycles, const uint16_t start) {
+    // JR and JP, conditional or not, to the taken or next address
+    static const uint8_t masks[4] = {0x80, 0x80, 0x10, 0x10}; // NZ, Z, NC, C
+    const bool relative = opcode == 0x18 || (opcode & 0xE7) == 0x20;
+    if (!relative && opcode != 0xC3 && (opcode & 0xE7) != 0xC2)
+        return false;
+
+    const uint16_t target = relative ? next + (int8_t)operand : operand;
+    if (opcode == 0x18 || opcode == 0xC3) {
+        jumpTo(e, target, cycles, start);
+        return true;
+    }
+    const bool carry = e->carry;
+    const uint8_t cc = opcode >> 3 & 0x3;
+    EMIT(0xF6); modrm(e, 0, RBP, CPU_(F)); EMIT(masks[cc]);
+    uint8_t *taken = jump(e, cc & 0x1 ? CC_NZ : CC_Z);
+    jumpTo(e, next, cycles, start);
+    land(e, taken);
+    e->carry = carry;
+    jumpTo(e, target, cycles + 1, start);
+    return true;
+}
+
+Jit* initJit(const Memory *mem) {
+    uint8_t *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return NULL;
+
+    Jit *jit = calloc(1, sizeof(Jit));
+    jit->code = code;
+    jit->nbBanks = mem->nbROMBanks;
+    jit->banks = calloc(mem->nbROMBanks, sizeof(*jit->banks));
+
+    // LAHF loads SF ZF 0 AF 0 PF 1 CF, F is Z N H C 0 0 0 0
+    for (uint16_t i = 0; i < 256; i++) {
+        jit->flags[0][i] = (i & 0x40 ? 0x80 : 0) | (i & 0x10 ? 0x20 : 0) | (i & 0x01 ? 0x10 : 0);
+        jit->flags[1][i] = jit->flags[0][i] | 0x40;
+    }
+    memcpy(jit->periods, (const uint16_t[]){256, 4, 16, 64}, sizeof(jit->periods));
+    return jit;
+}
+
+void deleteJit(Jit *jit) {
+    if (!jit)
+        return;
+    for (uint16_t bank = 0; bank < jit->nbBanks; bank++)
+        free(jit->banks[bank]);
+    free(jit->banks);
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+JitBlock* jitBank(Jit *jit, const uint16_t bank) {
+    return jit->banks[bank] = calloc(ROM_BANK_SIZE, sizeof(JitBlock));
+}
+
+void compileBlock(Jit *jit, const Memory *mem, const uint16_t bank, const uint16_t address) {
+    // Straight-line blocks like the recompiled ones, ending before the instructions that stop the CPU, which the
+    // interpreter runs. The cycles of the register-only runs are given to the timers once, before the next instruction
+    // that can observe them, or returned to the interpreter, which keeps accumulating them. The block stops where the
+    // interpreter would, at the break or with an interrupt to take, and loops when it jumps back to its start.
+    if (jit->used + JIT_BLOCK_SIZE > JIT_CODE_SIZE) {
+        for (uint16_t i = 0; i < jit->nbBanks; i++)
+            if (jit->banks[i])
+                memset(jit->banks[i], 0, ROM_BANK_SIZE * sizeof(JitBlock));
+        jit->used = 0;
+    }
+
+    JitBlock *block = &jit->banks[bank][address & 0x3FFF];
+    Emitter emitter = {.p = jit->code + jit->used, .carry = true, .blocks = jit->banks[bank], .bank = mem->romBanks[bank], .rom0 = address < 0x4000}, *e = &emitter;
+    e->c = e->cold;
+    const uint8_t *rom = mem->romBanks[bank];
+
+    EMIT(0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+    EMIT(0x48, 0x83, 0xEC, 0x18);
+    EMIT(0x48, 0x89, 0xFD);
+    EMIT(0x48, 0x89, 0x74, 0x24, 0x08);
+    EMIT(0x89, 0xD2);
+    EMIT(0x48, 0x89, 0x14, 0x24);
+    EMIT(0x4C, 0x8B); modrm(e, R12, RBP, CPU_(mem));
+    EMIT(0x49, 0xBD); imm64(e, (uintptr_t)jit->flags);
+    load(e, true);
+    e->body = e->p;
+    budget(e);
+
+    uint16_t pc = address, nbInstrs = 0, nbNative = 0;
+    uint32_t pending = 0;
+    bool end = false;
+    while (!end && nbInstrs < JIT_INSTRS && e->c + JIT_ROOM <= e->cold + JIT_COLD_SIZE && pc >> 14 == address >> 14 &&
+           (pc & 0x3FFF) < ROM_BANK_SIZE - 2) {
+        const uint8_t *code = &rom[pc & 0x3FFF];
+        const uint16_t opcode = code[0] == 0xCB ? 0x100 | code[1] : code[0];
+        const uint16_t operand = code[1] | code[2] << 8;
+        const char *source = instructions[opcode].code, *extra = strstr(source, "addCycles(");
+        const uint8_t length = instructions[opcode].length, duration = instructions[opcode].duration;
+        if (strstr(source, "return") || strstr(source, "UNREACHABLE") || (pc & 0x3FFF) + length > ROM_BANK_SIZE)
+            break;
+
+        const uint16_t next = pc + length;
+        const bool registerOnly = REGISTER_ONLY(source);
+        nbInstrs++;
+        end = strstr(source, "PC") || strstr(source, "IME");
+
+        if (branch(e, opcode, operand, next, pending + length + duration, address)) {
+            pending = 0;
+            nbNative++;
+            break;
+        }
+        if (!registerOnly) {
+            timers(e, pending);
+            pending = 0;
+        }
+        if (!translate(e, opcode, operand)) {
+            step(e, pc, opcode, operand);
+        } else {
+            nbNative++;
+            if (!registerOnly)
+                timers(e, length + duration + (extra ? atoi(extra + 10) : 0));
+        }
+
+        // The steps changing PC or IME end the block, PC is already set
+        const bool writes = strstr(source, "write") || strstr(source, "push(");
+        if (writes)
+            guard(e, !end, next);
+        if (end) {
+            chain(e, false, 0, address);
+        } else if (registerOnly) {
+            pending += length + duration;
+            if (pending < 0x80) {EMIT(0x49, 0x83, 0xFF, pending);} else {EMIT(0x49, 0x81, 0xFF); imm32(e, pending);}
+            leave(e, CC_LE, true, next, pending);
+        } else {
+            stop(e, true, next);
+        }
+        pc = next;
+    }
+
+    // Left to the interpreter when it would only step through it
+    if (nbNative == 0)
+        return;
+    if (!end)
+        leave(e, JMP, true, pc, pending);
+
+    // The exits set PC and return the cycles in esi
+    uint8_t *epilogue = e->p;
+    store(e, true);
+    EMIT(0x89, 0xF0);
+    EMIT(0x48, 0x83, 0xC4, 0x18);
+    EMIT(0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B, 0xC3);
+    for (uint8_t i = 0; i < e->nbExits; i++) {
+        const Exit *exit = &e->exits[i];
+        land(e, exit->jump);
+        if (exit->setPC) {EMIT(0x66, 0xC7); modrm(e, 0, RBP, CPU_(PC)); imm16(e, exit->pc);}
+        if (exit->carry) {
+            EMIT(0x8B, 0x34, 0x24);
+            EMIT(0x81, 0xC6); imm32(e, exit->pending);
+        } else {
+            EMIT(0xBE); imm32(e, exit->pending);
+        }
+        EMIT(0xE9); imm32(e, epilogue - (e->p + 4));
+    }
+
+    // Then the slow paths
+    uint8_t *slowPaths = e->p;
+    memcpy(slowPaths, e->cold, e->c - e->cold);
+    e->p += e->c - e->cold;
+    for (uint16_t i = 0; i < e->nbFixups; i++) {
+        uint8_t *rel = e->fixups[i].rel, *target = e->fixups[i].target;
+        if (rel >= e->cold && rel <= e->c) rel = slowPaths + (rel - e->cold);
+        if (target >= e->cold && target <= e->c) target = slowPaths + (target - e->cold);
+        const int32_t offset = target - (rel + 4);
+        memcpy(rel, &offset, 4);
+    }
+
+    block->code = (JitCode)(jit->code + jit->used);
+    block->body = e->body;
+    jit->used = (e->p - jit->code + 15) & ~15;
+}
+#endif
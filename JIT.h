@@ -0,0 +1,45 @@
+#pragma once
+
+#include "cpu.h"
+
+// Native x86-64 code for the hot ROM blocks, built with JIT defined on such hosts, see the README
+#if defined(JIT) && (defined(DEBUG) || defined(TEST))
+    #undef JIT // the blocks would skip the instruction log and the end of test detection
+#endif
+#if defined(JIT) && !defined(__x86_64__)
+    #error The JIT emits x86-64 code
+#endif
+
+#define JIT_HOT 16 // lookups of an address before its block is compiled
+#define JIT_NEAR 8 // cycles to the break under which the instructions are interpreted, cheaper than entering a block
+
+// Entered with the cycles the interpreter batched and not given to the timers yet, returns those it leaves batched
+typedef uint32_t (*JitCode)(CPU *cpu, const uint64_t breakAt, const uint32_t pending);
+
+typedef struct {
+    JitCode code; // NULL until compiled
+    const uint8_t *body; // past the prologue, where the blocks jumping to this one chain
+    uint8_t heat; // past JIT_HOT when the address can't start a block
+} JitBlock;
+
+struct Jit {
+    uint8_t *code; // executable buffer, emptied when full
+    uint32_t used;
+    uint16_t nbBanks;
+    JitBlock **banks; // per ROM bank and address in it, allocated on the first lookup
+    uint8_t flags[2][256]; // F after an ADD or a SUB, by the x86 flags loaded by LAHF
+    uint16_t periods[4]; // of the timer by TAC, as in incrTimersFor, addressed from flags
+};
+
+Jit* initJit(const Memory *mem) WARN_UNUSED_RESULT;
+void deleteJit(Jit *jit);
+
+JitBlock* jitBank(Jit *jit, const uint16_t bank);
+void compileBlock(Jit *jit, const Memory *mem, const uint16_t bank, const uint16_t address);
+
+// Implemented by the interpreter and called by the blocks, for the memory accesses off their fast paths, the timers
+// when a timer or a DMA is running, and the instructions they don't translate
+uint8_t jitRead(CPU *cpu, const uint16_t address);
+void jitWrite(CPU *cpu, const uint16_t address, const uint8_t value);
+void jitTimers(CPU *cpu, const uint32_t val);
+bool jitStep(CPU *cpu, const uint16_t opcode, const uint16_t operand, const uint64_t breakAt);
@@ -0,0 +1,66 @@
+#include "joypad.h"
+
+bool drainInputs(Memory *mem) {
+    static const struct {uint8_t scancode, group, mask;} mapping[8] = {
+        {0x2D, 0, 0x1}, // A (X)
+        {0x2E, 0, 0x2}, // B (C)
+        {0x39, 0, 0x4}, // Select (Space)
+        {0x36, 0, 0x8}, // Start (Right Shift)
+        {0x4D, 1, 0x1}, // Right
+        {0x4B, 1, 0x2}, // Left
+        {0x48, 1, 0x4}, // Up
+        {0x50, 1, 0x8}, // Down
+    };
+
+    // Returns whether a button got pressed, which raises the joypad interrupt
+    KeyEvents *keys = mem->keys;
+    uint8_t *buttons = mem->buttons, *unread = mem->unread, *releases = mem->releases;
+    bool pressed = false;
+    while (keys && keys->tail != keys->head) {
+        const uint64_t time = keys->times[keys->tail];
+        const uint8_t keyCode = keys->events[keys->tail++];
+        for (uint8_t i = 0; i < ARRAY_SIZE(mapping); i++) {
+            if ((keyCode & 0x7F) == mapping[i].scancode) {
+                const uint8_t g = mapping[i].group, mask = mapping[i].mask;
+                if (keyCode & 0x80) {
+                    // Released before the game read it, the press still shows once
+                    if (unread[g] & mask) releases[g] |= mask; else buttons[g] |= mask;
+                } else {
+                    pressed |= (buttons[g] & mask) != 0;
+                    if (keys->stamp && !mem->pendingPress) {mem->pendingPress = time; mem->pendingGroup = g;}
+                    buttons[g] &= ~mask;
+                    unread[g] |= mask;
+                    releases[g] &= ~mask;
+                }
+            }
+        }
+    }
+
+    return pressed;
+}
+
+static inline uint8_t readGroup(Memory *mem, const uint8_t group) {
+    if (UNLIKELY(mem->pendingPress) && group == mem->pendingGroup && !mem->observed) {
+        mem->observed = mem->pendingPress;
+        mem->pendingPress = 0;
+    }
+
+    const uint8_t value = mem->buttons[group];
+    mem->buttons[group] |= mem->releases[group];
+    mem->unread[group] = mem->releases[group] = 0;
+    return value;
+}
+
+uint8_t updateInputReg(Memory *mem, const uint8_t value) {
+    switch (value & 0x30) {
+        case 0x10: return readGroup(mem, 0);
+        case 0x20: return readGroup(mem, 1);
+        default: return 0x3F;
+    }
+}
+
+uint64_t observedPress(Memory *mem) {
+    const uint64_t time = mem->observed;
+    mem->observed = 0;
+    return time;
+}
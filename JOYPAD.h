@@ -0,0 +1,15 @@
+#pragma once
+
+#include "memory.h"
+
+// Single producer ring of scancodes, filled by the keyboard IRQ and drained by the emulation, the indices wrap with the
+// size. Times stamp the arrival of the events in the units of the IRQ, only for latency measurements.
+struct KeyEvents {
+    volatile uint8_t events[256], head, tail;
+    volatile uint64_t times[256];
+    volatile bool stamp;
+};
+
+bool drainInputs(Memory *mem);
+uint8_t updateInputReg(Memory *mem, const uint8_t value);
+uint64_t observedPress(Memory *mem);
@@ -15,7 +15,7 @@ INSTRUCTION(0x0D, "DEC C"       , 1, 0, "C1H-", cpu->C--; cpu->h = cpu->Cl == 0x
 INSTRUCTION(0x0E, "LD C,$%X"    , 2, 0, "----", cpu->C = operand)
 INSTRUCTION(0x0F, "RRCA"        , 1, 0, "000C", cpu->c = cpu->A & 1; cpu->A = cpu->A >> 1 | cpu->c << 7)
 
-INSTRUCTION(0x10, "STOP"        , 1, 0, "----", *(uint16_t*)&cpu->mem->IO[0x03] = 0; cpu->stopped = true; incrTimers(cpu, breakAt - cpu->cycles + 1); return true)
+INSTRUCTION(0x10, "STOP"        , 1, 0, "----", if (UNLIKELY(cpu->mem->cgb && cpu->mem->IO[0x4D] & 0x1)) switchSpeed(cpu); else {*(uint16_t*)&cpu->mem->IO[0x03] = 0; cpu->stopped = true; idle(cpu, breakAt); return true;})
 INSTRUCTION(0x11, "LD DE,$%X"   , 3, 0, "----", cpu->DE = operand)
 INSTRUCTION(0x12, "LD (DE),A"   , 1, 1, "----", write(cpu->DE, cpu->A))
 INSTRUCTION(0x13, "INC DE"      , 1, 1, "----", cpu->DE++)
@@ -62,7 +62,7 @@ INSTRUCTION(0x39, "ADD HL,SP"   , 1, 1, "-0HC", cpu->HL += cpu->SP; cpu->c = cpu
 INSTRUCTION(0x3A, "LD A,(HL-)"  , 1, 1, "----", cpu->A = read(cpu->HL--))
 INSTRUCTION(0x3B, "DEC SP"      , 1, 1, "----", cpu->SP--)
 INSTRUCTION(0x3C, "INC A"       , 1, 0, "A0H-", cpu->A++; cpu->h = cpu->Al == 0)
-INSTRUCTION(0x3D, "DEC A"       , 1, 0, "A1H-", cpu->A--; cpu->h = cpu->Al == 0xF)
+INSTRUCTION(0x3D, "DEC A"       , 1, 0, "A1H-", if (UNLIKELY(cpu->mem->dmaEnd)) skipDMAWait(cpu, breakAt); cpu->A--; cpu->h = cpu->Al == 0xF)
 INSTRUCTION(0x3E, "LD A,$%X"    , 2, 0, "----", cpu->A = operand)
 INSTRUCTION(0x3F, "CCF"         , 1, 0, "-00C", cpu->c = !cpu->c)
 
@@ -120,7 +120,7 @@ INSTRUCTION(0x72, "LD (HL),D"   , 1, 1, "----", write(cpu->HL, cpu->D))
 INSTRUCTION(0x73, "LD (HL),E"   , 1, 1, "----", write(cpu->HL, cpu->E))
 INSTRUCTION(0x74, "LD (HL),H"   , 1, 1, "----", write(cpu->HL, cpu->H))
 INSTRUCTION(0x75, "LD (HL),L"   , 1, 1, "----", write(cpu->HL, cpu->L))
-INSTRUCTION(0x76, "HALT"        , 1, 0, "----", cpu->halted = true; incrTimers(cpu, breakAt - cpu->cycles + 1); return true)
+INSTRUCTION(0x76, "HALT"        , 1, 0, "----", cpu->halted = true; idle(cpu, breakAt); return true)
 INSTRUCTION(0x77, "LD (HL),A"   , 1, 1, "----", write(cpu->HL, cpu->A))
 INSTRUCTION(0x78, "LD A,B"      , 1, 0, "----", cpu->A = cpu->B)
 INSTRUCTION(0x79, "LD A,C"      , 1, 0, "----", cpu->A = cpu->C)
@@ -258,14 +258,14 @@ INSTRUCTION(0xF0, "LDH A,($%X)" , 2, 1, "----", cpu->A = cpu->mem->IO[(uint8_t)o
 INSTRUCTION(0xF1, "POP AF"      , 1, 2, "ZNHC", cpu->AF = pop(); cpu->_unused = 0)
 INSTRUCTION(0xF2, "LDH A,(C)"   , 1, 1, "----", cpu->A = cpu->mem->IO[cpu->C])
 INSTRUCTION(0xF3, "DI"          , 1, 0, "----", cpu->IME = 0)
-INSTRUCTION(0xF4, "PAUSE"       , 1, 0, "----", incrTimers(cpu, breakAt - cpu->cycles + 1); return true)
+INSTRUCTION(0xF4, "PAUSE"       , 1, 0, "----", idle(cpu, breakAt); return true)
 INSTRUCTION(0xF5, "PUSH AF"     , 1, 3, "----", push(cpu->AF))
 INSTRUCTION(0xF6, "OR $%X"      , 2, 0, "A000", cpu->A |= operand)
 INSTRUCTION(0xF7, "RST $30"     , 1, 3, "----", push(cpu->PC); cpu->PC = 0x30)
 INSTRUCTION(0xF8, "LD HL,SP+$%X", 2, 1, "00HC", int16_t tmp = cpu->SP + (int8_t)operand; cpu->c = (tmp & 0xFF) < (cpu->SP & 0xFF); cpu->h = (tmp & 0xF) < (cpu->SP & 0xF); cpu->HL = tmp)
 INSTRUCTION(0xF9, "LD SP,HL"    , 1, 1, "----", cpu->SP = cpu->HL)
 INSTRUCTION(0xFA, "LD A,($%X)"  , 3, 1, "----", cpu->A = read(operand))
-INSTRUCTION(0xFB, "EI"          , 1, 0, "----", cpu->IME = 2)
+INSTRUCTION(0xFB, "EI"          , 1, 0, "----", cpu->IME = 1)
 INSTRUCTION(0xFC, ""            , 1, 0, "----", UNREACHABLE)
 INSTRUCTION(0xFD, ""            , 1, 0, "----", UNREACHABLE)
 INSTRUCTION(0xFE, "CP $%X"      , 2, 0, "Z1HC", cpu->z = cpu->A == (uint8_t)operand; cpu->c = cpu->A < (uint8_t)operand; cpu->h = cpu->Al < (operand & 0xF))
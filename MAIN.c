@@ -1,28 +1,72 @@
 #include "cpu.h"
-#include "screen.h"
+#include "ega.h"
 #include "sound.h"
 #include "buttons.h"
+#include "gbdos.h"
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define LOG 0
+#define LIST_FRAMES (60 * FPS)
+#define LATENCY_BINS 16
+#define LATENCY_BIN_MS 8
 
-static void emulate(const char *rom, const SoundDevice device, const bool bootSequence, const uint8_t frameSkip, const uint8_t hackLevel) {
-    SCOPED(CPU) cpu = initCPU(rom, bootSequence, hackLevel);
+typedef struct {
+    uclock_t press; // arrival of the key press observed by the game, 0 when none
+    uint32_t hash, histogram[LATENCY_BINS];
+} Latency;
+
+static uint32_t hashVideo(const Memory *mem) {
+    uint32_t hash = 2166136261u;
+    for (const uint32_t *p = (const uint32_t*)mem->VRAM; p < (const uint32_t*)(mem->VRAM + 2); p++) hash = (hash ^ *p) * 16777619u;
+    for (const uint32_t *p = (const uint32_t*)mem->OAM; p < (const uint32_t*)(mem->OAM + 40); p++) hash = (hash ^ *p) * 16777619u;
+    return hash;
+}
+
+// Time from a key press reaching the IRQ, through the game reading it, to the end of the first frame with new VRAM/OAM
+static void measureLatency(Latency *latency, Memory *mem) {
+    const uint32_t hash = hashVideo(mem);
+    if (!latency->press) {
+        const uint64_t stamp = observedPress(mem);
+        if (stamp) latency->press = keyTime(stamp);
+    }
+
+    if (latency->press && hash != latency->hash) {
+        const uint32_t ms = (uclock() - latency->press) * 1000 / UCLOCKS_PER_SEC;
+        latency->histogram[MIN(ms / LATENCY_BIN_MS, LATENCY_BINS - 1)]++;
+        latency->press = 0;
+    }
+
+    latency->hash = hash;
+}
+
+static float emulate(const char *rom, const SoundDevice device, const bool bootSequence, const uint8_t frameSkip, const uint8_t hackLevel, const bool fastForward, const uint8_t turboSkip, const bool rasterPalettes, const bool cgb, Latency *latency, const bool trace) {
+    SCOPED(CPU) cpu = initCPU(rom, bootSequence, hackLevel, cgb);
+    if (trace) cpu.trace = initTrace(cpu.mem);
 
 #ifndef DEBUG
-    const uint8_t mbc = cpu.mem->romBanks[0][0x147];
-    if ((mbc > 0x9 && mbc < 0x11) || (mbc > 0x1B && mbc < 0xFF)) {
-        puts("ERROR: Cartridge not supported! RTC and Rumble are not supported.");
-        return;
+    const uint8_t mbc = cpu.mem->mbcType;
+    if (mbc == 0xA || mbc == 0xE || (mbc > 0x1B && mbc < 0xFF)) {
+        puts("ERROR: Cartridge not supported! Rumble is not supported.");
+        return 0;
     }
 #endif
 
-    SCOPED(Screen) screen = initScreen(cpu.mem->IO, cpu.mem->VRAM, cpu.mem->OAM, hackLevel >= 1 ? 160 : 8);
+    SCOPED(Screen) screen = initScreen(cpu.mem, hackLevel == 0, 160);
     SCOPED(Sound) *sound = initSound(cpu.mem->IO, &screen.cycles, device);
-    SCOPED(Keyboard) keyb = initKeyboard();
+    SCOPED(Keyboard) keyb = initKeyboard(latency != NULL);
+    cpu.mem->keys = &keyEvents;
     uint8_t skip = frameSkip;
+    uint32_t turboFrames = 0;
+    uclock_t turboTime = 0, lastTime = uclock();
+    screen.turbo = fastForward;
+    screen.rasterPalettes = rasterPalettes;
 
-    while (!processEvents(sound->channels, &screen.background.enabled, &sound->loudness)) {
+    while (!processEvents(sound->channels, &screen.background.enabled, &sound->loudness, &screen.turbo)) {
+        // Inputs are also applied as soon as the game selects the buttons, this only catches games waiting for the interrupt
+        if (drainInputs(cpu.mem)) cpu.mem->IO[0x0F] |= 0x10;
         screen.tiles.enabled = screen.window.enabled = screen.background.enabled;
         setPalette(&screen, !sound->loudness);
 
@@ -30,14 +74,71 @@ static void emulate(const char *rom, const SoundDevice device, const bool bootSe
             nextInstructions(&cpu, screen.cycles, (FILE*)(LOG * (ptrdiff_t)stdout));
         }
 
-        nextAudio(sound);
-        skip = skip-- ? skip : frameSkip;
+        if (latency)
+            measureLatency(latency, cpu.mem);
+
+        // In fast-forward, the APU is only updated on displayed frames, it catches up on the skipped ones
+        if (!screen.turbo || skip == 0)
+            nextAudio(sound);
+
+        const uclock_t time = uclock();
+        if (screen.turbo) {
+            turboFrames++;
+            turboTime += time - lastTime;
+        }
+        lastTime = time;
+
+        skip = skip-- ? skip : screen.turbo ? turboSkip : frameSkip;
     }
+
+    if (cpu.trace) {
+        FILE *file = fopen("trace.bin", "wb");
+        if (file) {writeTrace(&cpu, file); fclose(file);}
+        file = fopen("hotspot.txt", "w");
+        if (file) {reportHotSpots(&cpu, file); fclose(file);}
+        deleteTrace(cpu.trace);
+    }
+
+    return turboTime ? (float)turboFrames * UCLOCKS_PER_SEC / (FPS * turboTime) : 0;
+}
+
+// Runs each ROM of the list headless for a minute of emulated time, saves are left untouched
+static void runList(const char *list, const uint8_t hackLevel, const bool cgb) {
+    FILE *file = fopen(list, "r");
+    if (!file) {
+        printf("Failed to open '%s'\n", list);
+        return;
+    }
+
+    char rom[128];
+    uint16_t nbROMs = 0;
+    uclock_t totalTime = 0;
+    while (fgets(rom, sizeof(rom), file)) {
+        rom[strcspn(rom, "\r\n")] = '\0';
+        if (!rom[0])
+            continue;
+
+        SCOPED(GameBoy) *gb = initGameBoy(rom, hackLevel, cgb);
+        gb->cpu.mem->savePath[0] = '\0';
+
+        const uclock_t start = uclock();
+        for (uint16_t frame = 0; frame < LIST_FRAMES; frame++)
+            runFrame(gb);
+
+        const uclock_t time = MAX(uclock() - start, 1);
+        printf("%s: %.1f fps\n", rom, (float)LIST_FRAMES * UCLOCKS_PER_SEC / time);
+        totalTime += time;
+        nbROMs++;
+    }
+
+    fclose(file);
+    if (nbROMs > 0)
+        printf("%u ROM(s): %.1f fps\n", nbROMs, (float)nbROMs * LIST_FRAMES * UCLOCKS_PER_SEC / totalTime);
 }
 
 int main(int argc, char *argv[]) {
-    bool bootSequence = false;
-    uint8_t frameSkip = 0, hackLevel = 1;
+    bool bootSequence = false, fastForward = false, rasterPalettes = false, cgb = false, list = false, measure = false, trace = false, disasm = false, recomp = false;
+    uint8_t frameSkip = 0, hackLevel = 1, turboSkip = 7;
     SoundDevice device = ADLIB;
     for (uint8_t i = 1; i < argc; i++) {
         if (argv[i][0] != '/' && argv[i][0] != '-')
@@ -46,24 +147,33 @@ int main(int argc, char *argv[]) {
         switch (argv[i][1]) {
             case 'b': bootSequence = true; break;
             case 'p': device = PC_SPEAKER; break;
-            case 't': device = TANDY; break;
+            case 't': if (argv[i][2] == 'r') trace = true; else device = TANDY; break;
+            case 'd': disasm = true; break;
             case 'a': device = ADLIB; break;
+            case 'r': if (argv[i][2] == 'e') recomp = true; else rasterPalettes = true; break;
+            case 'c': cgb = true; break;
+            case 'l': if (argv[i][2] == 'a') measure = true; else list = true; break;
             case 's': if (argv[i][2] >= '0' && argv[i][2] <= '9') frameSkip = argv[i][2] - '0';  break;
+            case 'f': fastForward = true; if (argv[i][2] >= '0' && argv[i][2] <= '9') turboSkip = argv[i][2] - '0'; break;
             case 'h': if (argv[i][2] >= '0' && argv[i][2] <= '9') { hackLevel = argv[i][2] - '0'; break; } FALLTHROUGH;
             case '?': FALLTHROUGH;
             case '-': puts(
                 "Game Boy emulator for DOS, by Gael Cathelin (C) 2025\n\n"
-                "GAMEBOY romfile [/boot] [/pcspeaker | /tandy | /adlib] [/s<n>] [/h<n>]\n\n"
+                "GAMEBOY romfile [/boot] [/pcspeaker | /tandy | /adlib] [/s<n>] [/f<n>] [/h<n>] [/raster] [/cgb] [/list] [/latency]\n\t[/trace] [/disasm] [/recompile]\n\n"
                 "romfile\t\tPath of the ROM to execute. Defaults to embedded Tetris game.\n"
-                "\t\tOnly no-MBC, MBC1, MBC2 and MBC5 cartridges are supported.\n"
+                "\t\tOnly no-MBC, MBC1, MBC2, MBC3, MBC5 and MMM01 cartridges are\n"
+                "\t\tsupported.\n"
                 "/boot\t\tRun the DMG-01 boot sequence.\n"
                 "/pcspeaker\tUse the PC Speaker for sound.\n"
                 "/tandy\t\tUse the Tandy/PCjr 3 voice system on port C0h for sound.\n"
                 "/adlib\t\tUse the Adlib/Sound Blaster FM synth for sound (default).\n"
                 "/s<n>\t\tSkip n frame(s) after every displayed frame (default: 0).\n"
-                "/h0\t\tHack level 0. Slower and more accurate emulation. CPU and\n"
-                "\t\tscreen are emulated at 8 pixels granularity, required for some\n"
-                "\t\trare special effects (e.g. wobble).\n"
+                "/f<n>\t\tStart in fast-forward mode, uncapped and skipping n frame(s)\n"
+                "\t\tafter every displayed frame (default: 7). Tab toggles it.\n"
+                "/h0\t\tHack level 0. Slower and more accurate emulation. Scroll,\n"
+                "\t\twindow and LCDC writes are tracked within each scanline, which\n"
+                "\t\tis drawn in spans between them, required for some rare special\n"
+                "\t\teffects (e.g. wobble).\n"
                 "/h1 (default)\tHack level 1. CPU and screen are emulated at scanline\n"
                 "\t\tgranularity. Might cause rare and harmless glitches.\n"
                 "/h2\t\tHack level 2. h1 with some common wait loop patterns detection\n"
@@ -72,11 +182,55 @@ int main(int argc, char *argv[]) {
                 "\t\tshould be mostly harmless.\n"
                 "/h3\t\tHack level 3. h2 with all remaining wait loop patterns skipping\n"
                 "\t\tCPU emulation until next interrupt. Glitches and crashes are\n"
-                "\t\tvery likely but if it works, it should be faster.");
+                "\t\tvery likely but if it works, it should be faster.\n"
+                "/raster\t\tApply palette changes on the scanline they happen, synchronized\n"
+                "\t\twith the screen beam, for games changing palettes mid-frame.\n"
+                "/cgb\t\tRun Game Boy Color enhanced games in color mode. Color only\n"
+                "\t\tgames always run in color mode.\n"
+                "/list\t\tromfile is a text file listing one ROM per line, each run\n"
+                "\t\twithout display nor sound for a minute of emulated time, as\n"
+                "\t\tfast as possible. Reports the speed of each ROM and overall.\n"
+                "/latency\tMeasure the time from key presses to the end of the first\n"
+                "\t\tframe with changed graphics, printed as a histogram on exit.\n"
+                "/trace\t\tRecord the last 65536 executed instructions in TRACE.BIN, and\n"
+                "\t\tthe banks and addresses taking the most cycles in HOTSPOT.TXT.\n"
+                "/disasm\t\tromfile is a trace file to print as assembly.\n"
+                "/recompile\tWrite the code reachable in romfile, patched for the hack\n"
+                "\t\tlevel, as C in RECOMP.INL for a 'make core' build.");
                 return 0;
         }
     }
 
-    emulate(argv[1], device, bootSequence, frameSkip, hackLevel);
+    if (disasm) {
+        FILE *file = fopen(argv[1], "rb");
+        if (file) {disassemble(file, stdout); fclose(file);}
+        return 0;
+    }
+
+    if (recomp) {
+        CPU cpu = initCPU(argv[1], false, hackLevel, cgb);
+        FILE *file = fopen("recomp.inl", "w");
+        if (file) {recompile(cpu.mem, file); fclose(file);}
+        deleteCPU(&cpu);
+        return 0;
+    }
+
+    if (list) {
+        runList(argv[1], hackLevel, cgb);
+        return 0;
+    }
+
+    Latency latency = {};
+    const float speed = emulate(argv[1], device, bootSequence, frameSkip, hackLevel, fastForward, turboSkip, rasterPalettes, cgb, measure ? &latency : NULL, trace);
+    if (speed > 0)
+        printf("Fast-forward speed: %.2fx\n", speed);
+
+    if (measure) {
+        printf("Input latency with /s%u /h%u%s%s:\n", frameSkip, hackLevel, fastForward ? " /f" : "", rasterPalettes ? " /raster" : "");
+        for (uint8_t i = 0; i < LATENCY_BINS - 1; i++)
+            printf("%3u-%3u ms: %lu\n", i * LATENCY_BIN_MS, (i + 1) * LATENCY_BIN_MS - 1, (unsigned long)latency.histogram[i]);
+        printf("%3u+    ms: %lu\n", (LATENCY_BINS - 1) * LATENCY_BIN_MS, (unsigned long)latency.histogram[LATENCY_BINS - 1]);
+    }
+
     return 0;
 }
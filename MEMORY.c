@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static const uint8_t defaultROM[0x8000] = {
     #include "tetris.rom"
@@ -13,19 +14,210 @@ static const struct {
     uint8_t mbcGen;
     char type[20];
 } mbcTypes[] = {
-    {false, 0, "NO MBC"             }, {false, 1, "MBC1"            }, {false, 1, "MBC1"        }, {true , 1, "MBC1+BATTERY" }, {false, 0, "UNKNOWN"     },
-    {false, 2, "MBC2"               }, {true , 2, "MBC2+BATTERY"    }, {false, 0, "UNKNOWN"     }, {false, 0, "NO MBC"       }, {true , 0, "BATTERY"     },
-    {false, 0, "UNKNOWN"            }, {false, 1, "MMM01"           }, {false, 1, "MMM01"       }, {true , 1, "MMM01+BATTERY"}, {false, 0, "UNKNOWN"     },
-    {true , 3, "MBC3+RTC+BATTERY"   }, {true , 3, "MBC3+RTC+BATTERY"}, {false, 3, "MBC3"        }, {true , 3, "MBC3"         }, {false, 3, "MBC3+BATTERY"},
-    {false, 0, "UNKNOWN"            }, {false, 0, "UNKNOWN"         }, {false, 0, "UNKNOWN"     }, {false, 0, "UNKNOWN"      }, {false, 0, "UNKNOWN"     },
-    {false, 5, "MBC5"               }, {false, 5, "MBC5"            }, {true , 5, "MBC5+BATTERY"}, {false, 5, "MBC5+RUMBLE"  }, {false, 5, "MBC5+RUMBLE" },
+    {false, 0, "NO MBC"             }, {false, 1, "MBC1"            }, {false, 1, "MBC1"        }, {true , 1, "MBC1+BATTERY" }, {false, 0, "UNKNOWN"         },
+    {false, 2, "MBC2"               }, {true , 2, "MBC2+BATTERY"    }, {false, 0, "UNKNOWN"     }, {false, 0, "NO MBC"       }, {true , 0, "BATTERY"         },
+    {false, 0, "UNKNOWN"            }, {false, 1, "MMM01"           }, {false, 1, "MMM01"       }, {true , 1, "MMM01+BATTERY"}, {false, 0, "UNKNOWN"         },
+    {true , 3, "MBC3+RTC+BATTERY"   }, {true , 3, "MBC3+RTC+BATTERY"}, {false, 3, "MBC3"        }, {false, 3, "MBC3+RAM"     }, {true , 3, "MBC3+RAM+BATTERY"},
+    {false, 0, "UNKNOWN"            }, {false, 0, "UNKNOWN"         }, {false, 0, "UNKNOWN"     }, {false, 0, "UNKNOWN"      }, {false, 0, "UNKNOWN"         },
+    {false, 5, "MBC5"               }, {false, 5, "MBC5"            }, {true , 5, "MBC5+BATTERY"}, {false, 5, "MBC5+RUMBLE"  }, {false, 5, "MBC5+RUMBLE"     },
     {true , 5, "MBC5+RUMBLE+BATTERY"}, {false, 0, "UNKNOWN"         }, {false, 6, "MBC6"        },
 };
 
-Memory* initMemory(const char *path, const uint8_t hackLevel) {
+static bool hasRTC(const Memory *mem) {
+    return mem->mbcType == 0x0F || mem->mbcType == 0x10;
+}
+
+void updateRTC(Clock *rtc, const uint64_t cycles) {
+    if (!rtc->halted) {
+        const uint64_t seconds = (cycles - rtc->cycles) / RTC_CLKS;
+        rtc->seconds += seconds;
+        rtc->cycles += seconds * RTC_CLKS;
+    } else {
+        rtc->cycles = cycles;
+    }
+
+    // The day counter is 9 bits, with a sticky carry when it overflows
+    if (rtc->seconds >= 512 * 86400) {
+        rtc->seconds %= 512 * 86400;
+        rtc->carry = true;
+    }
+}
+
+static void latchRTC(Clock *rtc, const uint64_t cycles) {
+    updateRTC(rtc, cycles);
+    const uint16_t days = rtc->seconds / 86400;
+    rtc->latched[0] = rtc->seconds % 60;
+    rtc->latched[1] = rtc->seconds / 60 % 60;
+    rtc->latched[2] = rtc->seconds / 3600 % 24;
+    rtc->latched[3] = days & 0xFF;
+    rtc->latched[4] = days >> 8 | rtc->halted << 6 | rtc->carry << 7;
+}
+
+static void writeRTC(Clock *rtc, const uint8_t reg, const uint8_t value, const uint64_t cycles) {
+    static const uint8_t masks[5] = {0x3F, 0x3F, 0x1F, 0xFF, 0xC1};
+
+    Clock current = *rtc;
+    latchRTC(&current, cycles);
+    uint8_t *regs = current.latched;
+    regs[reg] = value & masks[reg];
+
+    // Writing the registers resets the sub-second counter
+    rtc->seconds = regs[0] + regs[1] * 60 + regs[2] * 3600 + (regs[3] | (regs[4] & 0x1) << 8) * 86400ull;
+    rtc->cycles = cycles;
+    rtc->halted = regs[4] & 0x40;
+    rtc->carry = regs[4] & 0x80;
+    rtc->latched[reg] = regs[reg];
+}
+
+static void mapBanks(Memory *mem, const uint16_t rom0, const uint16_t romx, const uint8_t ramBank) {
+    mem->rom0 = mem->romBanks[rom0 & (mem->nbROMBanks - 1)];
+    mem->romx = mem->romBanks[romx & (mem->nbROMBanks - 1)];
+    mem->ramBank = mem->externalRAM[ramBank & (MAX(1, mem->nbRAMBanks) - 1)];
+    mem->sram = mem->ram && mem->nbRAMBanks ? mem->ramBank : NULL;
+}
+
+static uint8_t readDisabledRAM(const Memory *mem, const uint16_t address) {
+    UNUSED(mem); UNUSED(address);
+    return 0xFF;
+}
+
+static void writeDisabledRAM(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    UNUSED(mem); UNUSED(address); UNUSED(value); UNUSED(cycles);
+}
+
+static void mapNoMBC(Memory *mem) {
+    mapBanks(mem, 0, 1, 0);
+}
+
+static void writeNoMBC(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    UNUSED(mem); UNUSED(address); UNUSED(value); UNUSED(cycles);
+}
+
+static void mapMBC1(Memory *mem) {
+    const uint8_t upperBits = mem->mbcMode ? mem->currRAMBank : 0;
+    mapBanks(mem, upperBits << 5, mem->currRAMBank << 5 | mem->currROMBank, upperBits);
+}
+
+static void writeMBC1(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    UNUSED(cycles);
+    switch (address) {
+        case 0x0000 ... 0x1FFF: mem->ram = (value & 0xF) == 0xA; break;
+        case 0x2000 ... 0x3FFF: mem->currROMBank = (value & 0x1F) ? : 1; break;
+        case 0x4000 ... 0x5FFF: mem->currRAMBank = value & 0x3; break;
+        case 0x6000 ... 0x7FFF: mem->mbcMode = value & 1; break;
+    }
+    mapMBC1(mem);
+}
+
+// MBC2 has 512 half bytes of RAM, mirrored all over 0xA000-0xBFFF
+static void mapMBC2(Memory *mem) {
+    mapBanks(mem, 0, mem->currROMBank, 0);
+    mem->sram = NULL;
+}
+
+static void writeMBC2(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    UNUSED(cycles);
+    switch (address) {
+        case 0x0000 ... 0x3FFF: if (address & 0x100) mem->currROMBank = (value & 0xF) ? : 1; else mem->ram = (value & 0xF) == 0xA; break;
+    }
+    mapMBC2(mem);
+}
+
+static uint8_t readMBC2RAM(const Memory *mem, const uint16_t address) {
+    return mem->ram ? mem->ramBank[address & 0x1FF] | 0xF0 : 0xFF;
+}
+
+static void writeMBC2RAM(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    UNUSED(cycles);
+    if (mem->ram) mem->ramBank[address & 0x1FF] = value & 0xF;
+}
+
+// MBC3 maps the RTC registers instead of RAM when selecting banks 0x08 to 0x0C
+static void mapMBC3(Memory *mem) {
+    mapBanks(mem, 0, mem->currROMBank, mem->currRAMBank);
+    if (mem->currRAMBank & 0x8) mem->sram = NULL;
+}
+
+static void writeMBC3(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    switch (address) {
+        case 0x0000 ... 0x1FFF: mem->ram = (value & 0xF) == 0xA; break;
+        case 0x2000 ... 0x3FFF: mem->currROMBank = (value & 0x7F) ? : 1; break;
+        case 0x4000 ... 0x5FFF: mem->currRAMBank = value & 0xF; break;
+        case 0x6000 ... 0x7FFF: if ((value & 1) > mem->mbcMode) latchRTC(&mem->rtc, cycles); mem->mbcMode = value & 1; break;
+    }
+    mapMBC3(mem);
+}
+
+static uint8_t readMBC3RAM(const Memory *mem, const uint16_t address) {
+    UNUSED(address);
+    return mem->ram && mem->currRAMBank >= 0x8 && mem->currRAMBank <= 0xC ? mem->rtc.latched[mem->currRAMBank - 0x8] : 0xFF;
+}
+
+static void writeMBC3RAM(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    UNUSED(address);
+    if (mem->ram && mem->currRAMBank >= 0x8 && mem->currRAMBank <= 0xC) writeRTC(&mem->rtc, mem->currRAMBank - 0x8, value, cycles);
+}
+
+static void mapMBC5(Memory *mem) {
+    mapBanks(mem, 0, mem->currROMBank, mem->currRAMBank);
+}
+
+static void writeMBC5(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    UNUSED(cycles);
+    switch (address) {
+        case 0x0000 ... 0x1FFF: mem->ram = (value & 0xF) == 0xA; break;
+        case 0x2000 ... 0x2FFF: mem->currROMBank = (mem->currROMBank & 0x100) | value; break;
+        case 0x3000 ... 0x3FFF: mem->currROMBank = (mem->currROMBank & 0xFF) | (value & 1) << 8; break;
+        case 0x4000 ... 0x5FFF: mem->currRAMBank = value & 0xF; break;
+    }
+    mapMBC5(mem);
+}
+
+// MMM01 starts with the menu in the last 32k, which selects the game base bank before mapping it
+static void mapMMM01(Memory *mem) {
+    if (mem->mmm01Mapped)
+        mapBanks(mem, mem->mmm01Base, mem->mmm01Base + mem->currROMBank, mem->currRAMBank);
+    else
+        mapBanks(mem, mem->nbROMBanks - 2, mem->nbROMBanks - 1, 0);
+}
+
+static void writeMMM01(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles) {
+    UNUSED(cycles);
+    if (!mem->mmm01Mapped) {
+        switch (address) {
+            case 0x0000 ... 0x1FFF: mem->mmm01Mapped = true; break;
+            case 0x2000 ... 0x3FFF: mem->mmm01Base = (mem->mmm01Base & 0x180) | (value & 0x7F); break;
+            case 0x4000 ... 0x5FFF: mem->mmm01Base = (mem->mmm01Base & 0x7F) | (value & 0x30) << 3; break;
+        }
+    } else {
+        switch (address) {
+            case 0x0000 ... 0x1FFF: mem->ram = (value & 0xF) == 0xA; break;
+            case 0x2000 ... 0x3FFF: mem->currROMBank = (value & 0x7F) ? : 1; break;
+            case 0x4000 ... 0x5FFF: mem->currRAMBank = value & 0x3; break;
+        }
+    }
+    mapMMM01(mem);
+}
+
+static const Controller controllers[] = {
+    [0] = {writeNoMBC, mapNoMBC, readDisabledRAM, writeDisabledRAM},
+    [1] = {writeMBC1 , mapMBC1 , readDisabledRAM, writeDisabledRAM},
+    [2] = {writeMBC2 , mapMBC2 , readMBC2RAM    , writeMBC2RAM    },
+    [3] = {writeMBC3 , mapMBC3 , readMBC3RAM    , writeMBC3RAM    },
+    [4] = {writeMMM01, mapMMM01, readDisabledRAM, writeDisabledRAM},
+    [5] = {writeMBC5 , mapMBC5 , readDisabledRAM, writeDisabledRAM},
+    [6] = {writeNoMBC, mapNoMBC, readDisabledRAM, writeDisabledRAM},
+};
+
+Memory* initMemory(const char *path, const uint8_t hackLevel, const bool cgb) {
     Memory *mem = calloc(1, sizeof(Memory));
     mem->currROMBank = 1;
+    mem->vramBank = mem->VRAM[0];
+    mem->wramBank = mem->internalRAM[1];
     mem->IO[0] = 0x3F;
+    mem->buttons[0] = mem->buttons[1] = 0x3F;
+    mem->unread[0] = mem->unread[1] = mem->releases[0] = mem->releases[1] = 0;
+    mem->pendingPress = mem->observed = mem->pendingGroup = 0;
     memset(&mem->IO[0x4C], 0xFF, sizeof(mem->IO) - 0x4C);
     mem->IO[0x50] = 0;
 
@@ -111,27 +303,56 @@ Memory* initMemory(const char *path, const uint8_t hackLevel) {
         }
     }
 
-    const uint8_t mbcType = mem->romBanks[0][0x147];
-    if (mbcType > ARRAY_SIZE(mbcTypes)) {
+    // CGB only games always run in CGB mode, CGB enhanced ones only when requested
+    const uint8_t cgbFlag = mem->romBanks[0][0x143];
+    if (cgbFlag == 0xC0 || (cgb && cgbFlag == 0x80)) {
+        mem->cgb = true;
+        mem->IO[0x4D] = 0x7E;
+        mem->IO[0x4F] = 0xFE;
+        mem->IO[0x68] = mem->IO[0x6A] = 0x40;
+        mem->IO[0x69] = mem->IO[0x6B] = 0xFF;
+        mem->IO[0x70] = 0xF9;
+        memset(mem->palettes, 0xFF, sizeof(mem->palettes));
+        mem->palettesModified = true;
+    }
+
+    // MMM01 dumps have the header of the first game in bank 0, and the MMM01 one with the menu in the last 32k
+    const uint8_t *header = mem->romBanks[0];
+    if (mem->nbROMBanks > 2 && mem->romBanks[mem->nbROMBanks - 2][0x147] >= 0x0B && mem->romBanks[mem->nbROMBanks - 2][0x147] <= 0x0D)
+        header = mem->romBanks[mem->nbROMBanks - 2];
+
+    const uint8_t mbcType = mem->mbcType = header[0x147];
+    if (mbcType >= ARRAY_SIZE(mbcTypes)) {
         printf("Unsupported MBC (%02X)\n", mbcType);
         memset(mem->romBanks, 0xFF, ROM_BANK_SIZE);
+        mem->externalRAM = calloc(1, RAM_SIZE);
+        mem->mbc = &controllers[0];
+        mem->mbc->map(mem);
         return mem;
     }
 
+    static const uint8_t ramSizes[8] = {0, 2, 8, 32, 128, 64};
     mem->mbcGen = mbcTypes[mbcType].mbcGen;
-    const uint8_t ram = mem->mbcGen == 2 ? 8 : 2 << (mem->romBanks[0][0x149] << 1) >> 2;
-    const uint16_t romSize = 1 << (mem->romBanks[0][0x148] + 5);
+    const uint8_t ram = mem->mbcGen == 2 ? 8 : ramSizes[header[0x149] & 0x7];
+    const uint16_t romSize = 1 << (header[0x148] + 5);
     assert(mem->nbROMBanks == (romSize << 10) / ROM_BANK_SIZE);
     printf("%s - %dk ROM", mbcTypes[mbcType].type, romSize);
     if (ram) printf(" - %dk RAM", ram);
     putchar('\n');
 
-    mem->nbRAMBanks = (ram << 10) / RAM_SIZE;
-    assert(mem->nbRAMBanks <= 4);
-    mem->externalRAM = calloc(mem->nbRAMBanks, RAM_SIZE);
+    mem->nbRAMBanks = (ram + 7) / 8;
+    assert(mem->nbRAMBanks <= 16);
+    mem->externalRAM = calloc(MAX(1, mem->nbRAMBanks), RAM_SIZE);
+
+    // The bank registers are handled by a controller selected once, which maps the banks on every change
+    const bool mmm01 = mbcType >= 0x0B && mbcType <= 0x0D;
+    mem->mbc = &controllers[mmm01 ? 4 : mem->mbcGen];
+    mem->mmm01Base = mem->nbROMBanks - 2;
+    mem->ram = mem->mbcGen == 0;
+    mem->mbc->map(mem);
 
     if (mbcTypes[mbcType].battery) {
-        assert(ram > 0);
+        assert(ram > 0 || hasRTC(mem));
         strcpy(mem->savePath, path);
         char *dot = strchr(mem->savePath, '.');
         if (dot) *dot = '\0';
@@ -140,6 +361,22 @@ Memory* initMemory(const char *path, const uint8_t hackLevel) {
         if (file) {
             for (uint8_t i = 0; i < mem->nbRAMBanks; i++)
                 fread(&mem->externalRAM[i], 1, RAM_SIZE, file);
+
+            // Same RTC footer as VBA-M/BGB: current and latched registers as 32-bit values, then a UNIX timestamp
+            uint32_t regs[10];
+            uint64_t timestamp;
+            if (hasRTC(mem) && fread(regs, sizeof(*regs), 10, file) == 10 && fread(&timestamp, sizeof(timestamp), 1, file) == 1) {
+                for (uint8_t i = 0; i < 5; i++) {
+                    writeRTC(&mem->rtc, i, regs[i], 0);
+                    mem->rtc.latched[i] = regs[5 + i];
+                }
+
+                const uint64_t now = time(NULL);
+                if (!mem->rtc.halted && now > timestamp)
+                    mem->rtc.seconds += now - timestamp;
+                updateRTC(&mem->rtc, 0);
+            }
+
             fclose(file);
         }
     }
@@ -148,11 +385,25 @@ Memory* initMemory(const char *path, const uint8_t hackLevel) {
 }
 
 void deleteMemory(Memory *mem) {
-    if (mbcTypes[mem->romBanks[0][0x147]].battery) {
+    if (mem->mbcType < ARRAY_SIZE(mbcTypes) && mbcTypes[mem->mbcType].battery) {
         FILE *file = fopen(mem->savePath, "wb");
         if (file) {
             for (uint8_t i = 0; i < mem->nbRAMBanks; i++)
                 fwrite(mem->externalRAM[i], 1, RAM_SIZE, file);
+
+            if (hasRTC(mem)) {
+                Clock rtc = mem->rtc;
+                latchRTC(&rtc, rtc.cycles);
+                uint32_t regs[10];
+                const uint64_t timestamp = time(NULL);
+                for (uint8_t i = 0; i < 5; i++) {
+                    regs[i] = rtc.latched[i];
+                    regs[5 + i] = mem->rtc.latched[i];
+                }
+                fwrite(regs, sizeof(*regs), 10, file);
+                fwrite(&timestamp, sizeof(timestamp), 1, file);
+            }
+
             fclose(file);
         }
     }
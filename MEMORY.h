@@ -4,21 +4,85 @@
 
 #define ROM_BANK_SIZE 0x4000
 #define RAM_SIZE      0x2000
+#define WRAM_SIZE     0x1000
+#define DMA_CLKS      160
+#define RTC_CLKS      1048576
+#define SERIAL_CLKS   1024
 
 typedef struct {
-    uint8_t y, x, tile, _unused:4, palette:1, xflip:1, yflip:1, priority:1;
+    uint8_t y, x, tile, cgbPalette:3, bank:1, palette:1, xflip:1, yflip:1, priority:1;
 } Sprite;
 
 typedef struct {
-    uint8_t (*romBanks)[ROM_BANK_SIZE], VRAM[RAM_SIZE], (*externalRAM)[RAM_SIZE], internalRAM[RAM_SIZE];
+    uint8_t x, reg, value;
+} RegWrite;
+
+typedef struct {
+    uint64_t start; // cycle at which the first pixel of the line is output, 0 when not recording
+    uint8_t count;
+    bool overflowed; // more writes than the journal holds, the line can't be rewound
+    RegWrite writes[32];
+} LineJournal;
+
+// VRAM written since the screen cached its BG maps: tiles of both banks, and map cells per map and row of cells
+typedef struct {
+    uint32_t tiles[24], cells[2][32];
+    bool modified;
+} DirtyVRAM;
+
+// Set while the screen has lines left to draw, drawn before a write changes their VRAM, OAM or LCD registers
+typedef struct {
+    void *screen;
+    void (*draw)(void *screen);
+} LateLines;
+
+typedef struct {
+    uint64_t seconds, cycles; // clock value at the given CPU cycle, only updated when accessed
+    uint8_t latched[5];
+    bool halted, carry;
+} Clock;
+
+typedef struct Memory Memory;
+typedef struct KeyEvents KeyEvents;
+
+typedef struct {
+    void (*write)(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles);
+    void (*map)(Memory *mem);
+    // External RAM accesses when it isn't mapped directly (disabled, RTC or MBC2 nibbles)
+    uint8_t (*readRAM)(const Memory *mem, const uint16_t address);
+    void (*writeRAM)(Memory *mem, const uint16_t address, const uint8_t value, const uint64_t cycles);
+} Controller;
+
+struct Memory {
+    uint8_t (*romBanks)[ROM_BANK_SIZE], VRAM[2][RAM_SIZE], (*externalRAM)[RAM_SIZE], internalRAM[8][WRAM_SIZE];
+    const uint8_t *rom0, *romx;
+    uint8_t *ramBank, *sram; // sram is the RAM bank when directly accessible, NULL otherwise
+    uint8_t *vramBank, *wramBank;
     uint8_t patchMem[RAM_SIZE];
     Sprite OAM[40];
     uint8_t IO[0x80], HRAM[0x7F], interruptReg;
-    uint16_t currROMBank, nbROMBanks;
-    uint8_t currRAMBank, nbRAMBanks, mbcGen, rom0Bank, romBank, ramBank;
-    bool ram, mbcMode;
+    uint8_t palettes[2][64]; // CGB BG and OBJ palette RAM, 15-bit colors
+    uint8_t buttons[2]; // pressed buttons as read through P1, per selected group
+    uint8_t unread[2], releases[2]; // presses the game hasn't read yet per group, and their releases held back until it does
+    KeyEvents *keys; // host key ring drained into the buttons, NULL when the host sets them directly
+    uint64_t pendingPress, observed; // latency: arrival of the first press applied and of the one the game observed
+    uint8_t pendingGroup; // group of the pending press, only a read of that group observes it
+    uint16_t currROMBank, nbROMBanks, mmm01Base, hdmaSource, hdmaDest;
+    uint8_t currRAMBank, nbRAMBanks, mbcType, mbcGen, dmaSource, hdmaBlocks, hdmaLine;
+    bool ram, mbcMode, mmm01Mapped, oamModified, cgb, palettesModified;
+    bool interruptPending; // IE & IF, updated on CPU side changes and on entry to nextInstructions for the others
+    const Controller *mbc;
     char savePath[128];
-} Memory;
+    uint64_t dmaEnd; // cycle at which the running OAM DMA completes, 0 when idle
+    uint64_t serialEnd; // same for the serial transfer, only timed when linked
+    Memory *peer; // other end of the link cable
+    LineJournal journal;
+    DirtyVRAM dirtyVRAM;
+    LateLines lateLines;
+    Clock rtc;
+};
 
-Memory* initMemory(const char *path, const uint8_t hackLevel) WARN_UNUSED_RESULT;
+Memory* initMemory(const char *path, const uint8_t hackLevel, const bool cgb) WARN_UNUSED_RESULT;
 void deleteMemory(Memory *mem);
+
+void updateRTC(Clock *rtc, const uint64_t cycles);
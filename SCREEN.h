@@ -1,6 +1,7 @@
 #pragma once
 
 #include "memory.h"
+#include "export.h"
 
 #define SCREEN_LINE_CLKS 114
 #define SCREEN_ROWS      154
@@ -10,24 +11,63 @@ typedef struct {
     bool enabled;
 } Window;
 
+// Next thing the screen does, at line and dot. Line 0 starts on its OAM scan, LY was reset on the last line.
+typedef enum {
+    SCREEN_LY, SCREEN_OAM_SCAN, SCREEN_TRANSFER, SCREEN_HBLANK, SCREEN_VBLANK, SCREEN_LAST_LINE,
+} ScreenEvent;
+
+// Both BG maps rendered as 256x256 pixels, each word 8 pixels of the two bit planes like a tile row
+typedef struct {
+    uint16_t rows[2][256][32];
+    uint8_t attributes[2][32][32]; // CGB palette (bits 0-2) and priority over sprites (bit 7) of each cell
+    uint32_t dirty[2][32]; // cells to render again, per map and row of cells
+    uint8_t tileData; // LCDC bit 4 they were rendered with
+} MapCache;
+
+typedef struct Screen Screen;
+
+// The PC video hardware a screen draws on, none when headless
 typedef struct {
-    bool originalColors;
+    void (*startFrame)(Screen *screen, const bool draw);
+    void (*startLine)(Screen *screen, const uint8_t y); // before drawing any line but the first
+    void (*drawPixels)(Screen *screen, const uint8_t x, const uint8_t y, const uint8_t wy, const uint8_t nbPixels);
+    void (*clear)(Screen *screen);
+    void (*close)(Screen *screen);
+} Display;
+
+struct Screen {
+    const Display *display;
+    bool originalColors, cgb;
     Window screen, background, window, tiles;
 
     uint8_t wy, delay, *IO, visibleSprites, currPalette[3];
     const uint8_t *VRAM;
-    const Sprite *OAM;
-    Sprite sprites[10];
-    bool enabled;
+    const Sprite *OAM, *sprites;
+    const uint8_t (*palettes)[64];
+    LineJournal *journal;
+    LateLines *lateLines;
+    DirtyVRAM *dirtyVRAM;
+    MapCache *mapCache;
+    ExportRing *export;
+    ExportFrame *exportFrame;
+    Sprite lineSprites[144][10];
+    uint8_t nbLineSprites[144], indexedHeight;
+    uint8_t lineWindows[144], lateStart, lateEnd; // completed lines left to draw, with their window line
+    uint8_t lineShadow[4][20], planeMask; // planes of the line being drawn, and the sequencer map mask last written
+    uint8_t linePriority[20]; // pixels of the line from BG cells drawn over the sprites
+    bool enabled, turbo, rasterPalettes, drawLate, *oamModified, *palettesModified;
 
-    uint16_t physicalCycles;
-    uint64_t cycles;
+    ScreenEvent event;
+    uint8_t line, dot;
+    uint64_t cycles, frameStart; // cycles: when the next event happens
     uint8_t pixelBatch;
-} Screen;
+};
 
-Screen initScreen(uint8_t *IO, const uint8_t *VRAM, const Sprite *OAM, const uint8_t pixelBatch) WARN_UNUSED_RESULT;
+Screen initHeadlessScreen(Memory *mem) WARN_UNUSED_RESULT;
 void deleteScreen(Screen *screen);
 
-void setTitle(Screen *screen, const char *title);
-void setPalette(Screen *screen, const bool originalColors);
 bool nextPixels(Screen *screen, const bool draw);
+
+static inline bool windowEnabled(const Screen *screen, const uint8_t y) {
+    return screen->IO[0x40] & 0x20 && y >= screen->IO[0x4A] && y < screen->IO[0x4A] + 144 && screen->IO[0x4B] < 167;
+}
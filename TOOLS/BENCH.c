@@ -0,0 +1,84 @@
+#include "gbdos.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Runs a ROM headless for a number of frames and prints the best time of 5 runs, with a hash of the final state to
+// check that an optimization changes nothing. Without a ROM, a CPU-bound loop of loads, stores, ALU and CB ops and
+// relative jumps is run, which measures the instruction dispatch. Start is pressed every 100 frames, for games.
+
+static bool writeROM(const char *path) {
+    static uint8_t rom[0x8000];
+    const uint8_t entry[] = {0x00, 0xC3, 0x50, 0x01}; // nop, jp 0150
+    const uint8_t code[] = {
+        0x21, 0x00, 0xC0, // ld hl,C000
+        0x06, 0x00,       // ld b,0
+        0x7E,             // ld a,(hl)
+        0x80,             // add b
+        0x22,             // ld (hl+),a
+        0x04,             // inc b
+        0x7C,             // ld a,h
+        0xFE, 0xD0,       // cp D0
+        0x20, 0x02,       // jr nz,+2
+        0x26, 0xC0,       // ld h,C0
+        0x0D,             // dec c
+        0xCB, 0x11,       // rl c
+        0xA9,             // xor c
+        0x18, 0xEF,       // jr 0155
+    };
+    memset(rom, 0, sizeof(rom));
+    memcpy(&rom[0x100], entry, sizeof(entry));
+    memcpy(&rom[0x150], code, sizeof(code));
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+    const bool ok = fwrite(rom, sizeof(rom), 1, file) == 1;
+    fclose(file);
+    return ok;
+}
+
+static uint32_t hashState(const GameBoy *gb) {
+    const Memory *mem = gb->cpu.mem;
+    uint32_t hash = 0;
+    for (uint8_t bank = 0; bank < ARRAY_SIZE(mem->internalRAM); bank++)
+        for (uint16_t i = 0; i < WRAM_SIZE; i++)
+            hash = hash * 31 + mem->internalRAM[bank][i];
+    for (uint16_t i = 0; i < RAM_SIZE; i++)
+        hash = hash * 31 + mem->VRAM[0][i];
+    return hash;
+}
+
+int main(int argc, char **argv) {
+    const char *rom = argc > 1 ? argv[1] : "bench.gb";
+    const uint32_t frames = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+    const uint8_t hackLevel = argc > 3 ? atoi(argv[3]) : 1;
+    if (argc < 2 && !writeROM(rom)) {
+        puts("Failed to write the ROM");
+        return 1;
+    }
+
+    clock_t best = 0;
+    for (uint8_t run = 0; run < 5; run++) {
+        SCOPED(GameBoy) *gb = initGameBoy(rom, hackLevel, false);
+        gb->cpu.mem->savePath[0] = '\0';
+
+        const clock_t start = clock();
+        for (uint32_t i = 0; i < frames; i++) {
+            if (i % 100 == 50) setInput(gb, BUTTON_START);
+            else if (i % 100 == 55) setInput(gb, 0);
+            runFrame(gb);
+        }
+        const clock_t time = clock() - start;
+        best = run == 0 ? time : MIN(best, time);
+
+        if (run == 0)
+            printf("AF %04X BC %04X DE %04X HL %04X SP %04X PC %04X cycles %llu state %08lX\n", gb->cpu.AF, gb->cpu.BC, gb->cpu.DE, gb->cpu.HL, gb->cpu.SP, gb->cpu.PC, (unsigned long long)gb->cpu.cycles, (unsigned long)hashState(gb));
+    }
+    if (argc < 2)
+        remove(rom);
+
+    printf("%lu frames in %lu ms\n", (unsigned long)frames, (unsigned long)(best * 1000 / CLOCKS_PER_SEC));
+    return 0;
+}
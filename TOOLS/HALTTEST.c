@@ -0,0 +1,60 @@
+#include "gbdos.h"
+#include <stdio.h>
+#include <string.h>
+
+// Runs a ROM halting after a few register-only instructions, with the timer interrupt enabled. The emulated time
+// must follow the frames, HALT used to skip about 2^32 cycles when batched cycles overran the break.
+
+#define FRAMES 600
+
+static bool writeROM(const char *path) {
+    static uint8_t rom[0x8000];
+    const uint8_t entry[] = {0x00, 0xC3, 0x50, 0x01}; // nop, jp 0150
+    const uint8_t timer[] = {0xD9};                  // reti
+    const uint8_t code[] = {
+        0x3E, 0x04, 0xE0, 0xFF, // ld a,04, ldh (IE),a
+        0x3E, 0x05, 0xE0, 0x07, // ld a,05, ldh (TAC),a
+        0xFB,                   // ei
+        0x3E, 0x01,             // ld a,1
+        0x47,                   // ld b,a
+        0x4F,                   // ld c,a
+        0x76,                   // halt
+        0x00,                   // nop
+        0x18, 0xF8,             // jr 0159
+    };
+    memset(rom, 0, sizeof(rom));
+    memcpy(&rom[0x50], timer, sizeof(timer));
+    memcpy(&rom[0x100], entry, sizeof(entry));
+    memcpy(&rom[0x150], code, sizeof(code));
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+    const bool ok = fwrite(rom, sizeof(rom), 1, file) == 1;
+    fclose(file);
+    return ok;
+}
+
+int main() {
+    if (!writeROM("halt.gb")) {
+        puts("Failed to write the ROM");
+        return 1;
+    }
+
+    SCOPED(GameBoy) *gb = initGameBoy("halt.gb", 1, false);
+    gb->cpu.mem->savePath[0] = '\0';
+    remove("halt.gb");
+
+    const uint64_t frameCycles = SCREEN_LINE_CLKS * SCREEN_ROWS;
+    for (uint16_t i = 0; i < FRAMES; i++) {
+        runFrame(gb);
+        if (gb->cpu.cycles > (i + 2) * frameCycles) {
+            printf("frame %u: cycles %llu FAILED\n", i, (unsigned long long)gb->cpu.cycles);
+            return 1;
+        }
+    }
+
+    const bool ok = gb->cpu.cycles >= (FRAMES - 1) * frameCycles;
+    printf("%u frames: cycles %llu %s\n", FRAMES, (unsigned long long)gb->cpu.cycles, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
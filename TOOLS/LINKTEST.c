@@ -0,0 +1,56 @@
+#include "gbdos.h"
+#include <stdio.h>
+#include <string.h>
+
+// Links two instances running minimal ROMs: the first one sends 0x42 on its internal clock, the second one answers
+// 0x99 on the external clock. Both must end with the other byte in SB, SC bit 7 cleared and the serial interrupt.
+
+static bool writeROM(const char *path, const uint8_t sb, const uint8_t sc) {
+    static uint8_t rom[0x8000];
+    const uint8_t entry[] = {0x00, 0xC3, 0x50, 0x01}; // nop, jp 0150
+    const uint8_t code[] = {
+        0xF3,             // di
+        0xAF, 0xE0, 0x0F, // xor a, ldh (IF),a
+        0x3E, sb,         // ld a,sb
+        0xE0, 0x01,       // ldh (SB),a
+        0x3E, sc,         // ld a,sc
+        0xE0, 0x02,       // ldh (SC),a
+        0x18, 0xFE,       // jr $
+    };
+    memset(rom, 0, sizeof(rom));
+    memcpy(&rom[0x100], entry, sizeof(entry));
+    memcpy(&rom[0x150], code, sizeof(code));
+
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return false;
+    const bool ok = fwrite(rom, sizeof(rom), 1, file) == 1;
+    fclose(file);
+    return ok;
+}
+
+static bool check(const char *name, const GameBoy *gb, const uint8_t sb) {
+    const uint8_t *IO = gb->cpu.mem->IO;
+    const bool ok = IO[0x01] == sb && !(IO[0x02] & 0x80) && IO[0x0F] & 0x8;
+    printf("%s: SB %02X SC %02X IF %02X %s\n", name, IO[0x01], IO[0x02], IO[0x0F], ok ? "ok" : "FAILED");
+    return ok;
+}
+
+int main() {
+    if (!writeROM("master.gb", 0x42, 0x81) || !writeROM("slave.gb", 0x99, 0x80)) {
+        puts("Failed to write the ROMs");
+        return 1;
+    }
+
+    SCOPED(GameBoy) *master = initGameBoy("master.gb", 1, false);
+    SCOPED(GameBoy) *slave = initGameBoy("slave.gb", 1, false);
+    master->cpu.mem->savePath[0] = slave->cpu.mem->savePath[0] = '\0';
+    remove("master.gb");
+    remove("slave.gb");
+
+    connectLink(master, slave);
+    runLinked(master, slave, 4 * SERIAL_CLKS);
+
+    const bool ok = check("master", master, 0x99) & check("slave", slave, 0x42);
+    return ok ? 0 : 1;
+}